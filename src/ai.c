@@ -8,6 +8,8 @@
  * (C) Sochima Biereagu, 2017
 */
 
+#include <stddef.h>   // offsetof
+
 #include "game.c"
 
 
@@ -28,48 +30,492 @@
 unsigned int DEEP_HASHTABLE_SIZE = 199999;
 unsigned int BIG_HASHTABLE_SIZE = 799996;
 
+int CPU = -1;        // core the search thread is pinned to (-1 => not pinned)
+bool NUMA = false;   // put the TTables on the NUMA node of `CPU`
+
 // flags
 // #define LOWER_BOUND 0
 // #define UPPER_BOUND 1
 // #define EXACT_SCORE 2
 enum {LOWER_BOUND, UPPER_BOUND, EXACT_SCORE};
 
-// Transposition table entry
+#define HASH_MIN_DEPTH 2   // shallower results arent stored (or probed)
+
+int ETC_DEPTH = 4;         // probe the children for cutoffs from this depth (0 => off)
+
+// Transposition table slot, two words the search threads read and write
+//  without locks: the entry packed in `data` (see tentry_write()) and the
+//  position key ^ data, so an entry torn by two writers fails the key check
 struct TEntry {
-	u64 key, lock;
+	u64 key;
+	u64 data;
+};
 
-	int eval: 13;
-	int flag: 2;
-	int depth: 6;
+// Transposition table entry, as read from a slot (see tentry_read())
+struct tentry {
+	u64 key;
 
-	int color: 1;
+	int eval;
+	int flag;
+	int depth;
+	int color;
 
-	bool occupied: 1;
+	bool occupied;
 
 	int move_from;
 	int move_to;
 };
 
+// mate scores are stored as the distance from the node, not from the root
+#define score_to_tt(v, ply) (((v) >= MATE-MAXDEPTH) ? (v) + (ply) : ((v) <= -MATE+MAXDEPTH) ? (v) - (ply) : (v))
+#define score_from_tt(v, ply) (((v) >= MATE-MAXDEPTH) ? (v) - (ply) : ((v) <= -MATE+MAXDEPTH) ? (v) + (ply) : (v))
+
+
+////////////////
+// Quiescence //
+////////////////
+
+// capture ordering values
+#define QS_MAN 1
+#define QS_KING 3
+#define QS_PROMOTION 8
+
+
+//////////////////////////////
+// Futility pruning/Razoring //
+//////////////////////////////
+
+// quiet non-PV nodes this close to the horizon,
+//  margins indexed by depth
+#define FRONTIER_DEPTH 3
+
+int FUTILITY_MARGIN[FRONTIER_DEPTH+1] = {0, 150, 250, 350};  // eval + margin <= alpha => only the first move and promotions
+int RAZOR_MARGIN[FRONTIER_DEPTH+1] = {0, 300, 450, 600};     // eval + margin <= alpha => quiescence search
+
+
+/////////////
+// History //
+/////////////
+
+// butterfly (side, from, to) and continuation (previous piece and square => piece, to)
+//  scores, updated with `h += bonus - h * |bonus| / HISTORY_MAX` so they stay in
+//  +-HISTORY_MAX and old results fade out
+#define HISTORY_MAX 16384
+#define HISTORY_BONUS(d) min((d) * (d) * 32, HISTORY_MAX / 4)
+
+// 0..3 index of a piece, white/black man/king
+#define PIECE_INDEX(v) ((((v) & BLACK) ? 2 : 0) + (((v) & KING) ? 1 : 0))
+
+
+///////////////////////////////
+// Late move reductions/pruning //
+///////////////////////////////
+
+// reduction of the i-th move at depth d => LMR_BASE + log2(d) * log2(i) / LMR_DIV,
+//  one ply less for each LMR_HISTORY of history score (more for a negative score)
+int LMR_DEPTH = 4;         // reduce from this depth
+int LMR_MOVES = 4;         // moves searched before reducing
+int LMR_BASE = 50;         // (x100)
+int LMR_DIV = 300;         // (x100)
+int LMR_HISTORY = 8192;
+
+// prune quiet moves with history score < LMP_HISTORY after the
+//  first LMP_MOVES + depth*depth (depth <= LMP_DEPTH)
+int LMP_DEPTH = 3;
+int LMP_MOVES = 3;
+int LMP_HISTORY = 100;
+
+// filled by lmr_init() once (the first search), and again when an LMR option is set
+int LMR_TABLE[MAXDEPTH][MAXMOVES];
+once_t LMR_ONCE;
+
+
+/////////////////////////
+// Singular extensions //
+/////////////////////////
+
+// the hash move is extended if the other moves fail low at
+//  half depth against (its TTable score - SE_MARGIN * depth)
+int SE_DEPTH = 8;    // (0 => off)
+int SE_MARGIN = 10;
+
+
+/////////////
+// ProbCut //
+/////////////
+
+// a shallow search at `depth - PROBCUT_REDUCTION` predicts the deep score,
+//  deep = a * shallow + b, with error sigma (fit with `make probcut`)
+int PROBCUT_DEPTH = 6;          // try it from this depth (0 => off)
+int PROBCUT_REDUCTION = 3;
+
+double PROBCUT_A = 1.075,
+	PROBCUT_B = 12.46,
+	PROBCUT_SIGMA = 126.08,
+	PROBCUT_T = 1.5;             // cut if the deep score is >= beta with t*sigma to spare
+
+
+////////////////
+// Evaluation //
+////////////////
+
+enum {EVAL_HANDWRITTEN, EVAL_PATTERNS, EVAL_NNUE, EVAL_BITBOARD};
+
+int EVAL = EVAL_HANDWRITTEN;   // evaluator the search uses ('set eval')
+
+#define EVAL_INF (MATE*10)     // evaluate() window without lazy exits
+
+// weights file fields ('.name = values' in a weights file, see src/weights.c)
+struct weightfield {
+	char* name;
+	size_t offset;
+	int count;
+} WEIGHT_FIELDS[] = {
+	{"man", offsetof(struct weights, man), 1},
+	{"king", offsetof(struct weights, king), 1},
+	{"exchange", offsetof(struct weights, exchange), 1},
+	{"turn", offsetof(struct weights, turn), 1},
+	{"balance", offsetof(struct weights, balance), 1},
+	{"king_balance", offsetof(struct weights, king_balance), 1},
+	{"backrank", offsetof(struct weights, backrank), 1},
+	{"backrank_values", offsetof(struct weights, backrank_values), 16},
+	{"psq", offsetof(struct weights, psq), BOARD_SIZE},
+	{"c5", offsetof(struct weights, c5), 1},
+	{"e5", offsetof(struct weights, e5), 1},
+};
+
+#define WEIGHT_FIELDS_N (sizeof(WEIGHT_FIELDS) / sizeof(struct weightfield))
+
+// lazy evaluation, the handwritten evaluator returns a bound from its material and king
+//  terms when they are this far out of the window, the most the other terms can add up to
+//  (108 with the default weights: balance 24 + back rank 30 + piece-square 43 + c5 5 + e5 6)
+#define LAZY_MARGIN POSITIONAL_MAX
+
+// pattern evaluation, weights looked up by the men on 4x4 board
+//  windows (the indices are kept in Gamestate), kings are counted apart
+
+// tables file, the header then `short weights[PATTERN_WINDOWS][PATTERN_STATES]`
+//  (+ => good for black, like evaluate())
+struct patterns {
+	char magic[4];     // "KDPT"
+	int windows, states;
+	short king;        // value of a king
+	short turn;        // side to move bonus
+	short weights[];
+};
+
+struct patterns* PATTERNS = NULL;   // mapped tables file, NULL => none loaded
+size_t PATTERNS_SIZE = 0;
+
+// neural network evaluation, the first layer is kept in Gamestate's accumulators
+//  by domove()/undomove(), the rest runs on each call:
+//  2 x NNUE_HIDDEN (side to move first, clipped to 0..127) => NNUE_L1 => NNUE_L2 => 1
+#define NNUE_L1 32
+#define NNUE_L2 32
+#define NNUE_SHIFT 6   // hidden layer sums >> NNUE_SHIFT, then clipped to 0..127
+
+// network file, the header then
+//  short input weights[NNUE_INPUTS][NNUE_HIDDEN], short input biases[NNUE_HIDDEN],
+//  signed char l1 weights[NNUE_L1][2*NNUE_HIDDEN], int l1 biases[NNUE_L1],
+//  signed char l2 weights[NNUE_L2][NNUE_L1], int l2 biases[NNUE_L2],
+//  signed char output weights[NNUE_L2], int output bias
+struct network {
+	char magic[4];     // "KDNN"
+	int inputs, hidden, l1, l2;
+	int scale;         // evaluation = output / scale, for the side to move
+};
+
+#define NNUE_FILE_SIZE (sizeof(struct network) \
+	+ (NNUE_INPUTS+1) * NNUE_HIDDEN * sizeof(short) \
+	+ NNUE_L1 * 2*NNUE_HIDDEN + NNUE_L1 * sizeof(int) \
+	+ NNUE_L2 * NNUE_L1 + NNUE_L2 * sizeof(int) \
+	+ NNUE_L2 + sizeof(int))
+
+// mapped network file and its layers (the first one is NNUE_WEIGHTS/NNUE_BIASES)
+struct nnue {
+	struct network* file;   // NULL => none loaded
+	size_t size;
+
+	const signed char *l1_weights, *l2_weights, *out_weights;
+	const int *l1_biases, *l2_biases, *out_bias;
+} NNUE = {NULL};
+
+// kernels, AVX2 when the build targets it
+#ifdef __AVX2__
+	#define nnue_transform nnue_transform_avx2
+	#define nnue_layer nnue_layer_avx2
+#else
+	#define nnue_transform nnue_transform_scalar
+	#define nnue_layer nnue_layer_scalar
+#endif
+
+// batch evaluation (evaluate_batch()), the widest kernel the build targets
+//  and the positions it evaluates per pass
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+	#define BATCH_LANES 16
+	#define evaluate_batch_kernel evaluate_batch_avx512
+#elif defined(__AVX2__)
+	#define BATCH_LANES 8
+	#define evaluate_batch_kernel evaluate_batch_avx2
+#else
+	#define BATCH_LANES 1
+	#define evaluate_batch_kernel evaluate_batch_scalar
+#endif
+
+
+////////////////
+// Eval cache //
+////////////////
+
+// evaluate() results of the search, direct mapped, an entry is
+//  the key's high 32 bits (low bit set, 0 => empty) << 32 | the score,
+//  only for the pattern/network evaluators (the handwritten one, with its
+//  incremental terms, is cheaper than a probe that misses the CPU cache)
+int EVALCACHE_KB = 128;         // size, 'set evalcache <kb>' (0 => off)
+
+// allocated by the first search (see evalcache_alloc()), resized only when none is running
+u64* EVALCACHE = NULL;
+unsigned int EVALCACHE_SIZE = 0; // entries, a power of 2
+once_t EVALCACHE_ONCE;
+
+#define EVALCACHE_BLACK 0x9E3779B97F4A7C15ULL   // xored into the key with black to move
+
+
+//////////////////
+// Time manager //
+//////////////////
+
+#define SOFT_LIMIT 1.0    // (x maxtime) dont start an iteration that wont finish by then
+#define HARD_LIMIT 2.5    // (x maxtime) abort the search
+#define TIMER_NODES 4096  // nodes between stop checks (power of 2)
+
+struct timer {
+	double start;
+	double soft, hard;  // limits in seconds
+	double last;        // duration of the last finished iteration
+
+	int maxdepth;       // depth limit
+
+	int* play;          // CheckerBoard's `playnow` flag (atomic pointer)
+	int stop;           // search must stop (atomic)
+	int ponder;         // pondering, no time limits until the ponder hit (atomic)
+};
+
+#define NO_EVAL INT_MIN
+
+// search data of one ply
+struct stack {
+	one_capt killers[2];   // quiet moves that failed high at this ply (from, to)
+	int static_eval;       // NO_EVAL => not computed
+	Move* excluded;        // singular search, skip this move
+	short moved;           // move played (piece * 32 + to)
+};
+
 struct info {
-	unsigned long History[32][32];
-	struct move_or_capture counterMoves[2][32][32];
+	int History[2][32][32];                   // [side][from][to]
+	int ContHistory[2][4][32][4][32];         // [1 or 2 plies back][piece][to] => [piece][to]
+
+	struct stack stack[MAXDEPTH+2];           // (+2, grandchild killers are cleared)
+
+	// triangular PV table, pv[ply] is the best line from `ply`
+	Move pv[MAXDEPTH][MAXDEPTH];
+	int pv_length[MAXDEPTH];
+
+	// PV of the last finished iteration, searched first
+	Move pv_line[MAXDEPTH];
+	u64 pv_keys[MAXDEPTH];   // positions its moves are played in
+	int pv_moves;
 
-	unsigned long killer1_from[MAXDEPTH];
-	unsigned long killer1_to[MAXDEPTH];
+	// beta cutoffs, and how many came from the first move searched
+	unsigned long cutoffs, first_cutoffs;
 
-	unsigned long killer2_from[MAXDEPTH];
-	unsigned long killer2_to[MAXDEPTH];
+	// eval cache probes and hits, handwritten evaluations and their lazy exits
+	//  (summed from the MultiPV workers)
+	unsigned long cache_probes, cache_hits;
+	unsigned long lazy_evals, lazy_exits;
 } _info;
 
 
+/////////////
+// MultiPV //
+/////////////
+
+int MULTIPV = 1;   // number of root lines searched with exact scores
+int THREADS = 1;   // root search workers (MultiPV mode)
+
+// root move and its score from the last search
+struct rootmove {
+	Move move;
+	int eval;
+	bool exact;    // false if `eval` is only an upper bound
+	char pv[200];  // line (move notation), if `exact`
+};
+
+// root search, shared by the workers
+struct rootsearch {
+	Gamestate* game;
+	struct rootmove* list;
+
+	int first, last;   // root moves searched in this pass
+	int next;          // next root move to take (atomic)
+
+	int depth, color;
+	bool full;         // full window, else null window at `bound`
+	int bound;
+
+	struct TEntry* TTable_deep;
+	struct TEntry* TTable_big;
+	struct timer* timer;
+};
+
+// root worker, has its own heuristic tables
+struct rootworker {
+	struct rootsearch* rs;
+	struct info info;
+	int nodes;
+	thread_t thread;
+};
+
+
+///////////////////////
+// Background search //
+///////////////////////
+
+#define NO_TIME_LIMIT 1e9
+
+// search limits
+struct limits {
+	double time;   // seconds, 0 => until stopped
+	int depth;     // 0 => no limit
+};
+
+// search progress
+struct searchinfo {
+	int depth;             // last finished iteration
+	int eval;
+	int nodes;
+	double time;
+	char pv[200];          // best line (move notation)
+
+	bool running;
+	double stop_latency;   // seconds from the stop request until the search returned
+};
+
+// progress shared with the polling thread
+struct live {
+	lock_t lock;
+	struct searchinfo info;
+};
+
+// search running on its own thread
+struct search {
+	Gamestate game;
+	int color;
+
+	struct TEntry* TTable_deep;
+	struct TEntry* TTable_big;
+	struct info info;
+	struct timer timer;
+	int play;                        // `playnow` flag (never set)
+	int cpu;                         // core to pin the search thread to (-1 => none)
+
+	void (*done)(struct search*);    // called from the search thread when it returns
+	void* data;                      // for `done`
+
+	Move best;
+	int res;
+	char str[1024];
+
+	struct live live;
+	double stop_time;                // when the stop was requested
+
+	bool active;                     // thread not joined yet
+	thread_t thread;
+};
+
+
+///////////////
+// Pondering //
+///////////////
+
+bool PONDER = false;   // keep searching on the opponent's time
+
+struct ponder {
+	struct search search;       // on the position after our move and the expected reply
+	int reply_from, reply_to;   // the expected reply
+} _ponder;
+
+
 /* prototypes */
-int evaluate(Gamestate*, int, int);
-void addkiller(struct info*, int, int, int);
-void addhistory(struct info*, int, int, int, bool);
-void addcounter(struct info* info, int, int, int, int, int);
-bool hashcheck(struct TEntry*, struct TEntry*, Gamestate*, int*, int*, int, int, int*, int*, int*);
-void hashstore(struct TEntry*, struct TEntry*, Gamestate*, int, int, int, int, Move);
-int negamax(Gamestate*, int, int, int, int, int, Move*, struct TEntry*, struct TEntry*, struct info*, int*, int*, bool);
+bool tables_alloc(struct TEntry**, struct TEntry**, int);
+void tables_free(struct TEntry*, struct TEntry*);
+void timer_start(struct timer*, double, int*);
+void timer_ponderhit(struct timer*, double, int*);
+double timer_elapsed(struct timer*);
+bool timer_stopped(struct timer*, int);
+bool timer_next(struct timer*, double);
+int evaluate(Gamestate*, int, int, int, int, struct info*);
+int evaluate_cached(Gamestate*, int, int, int, int, struct info*);
+int evaluate_structure(Gamestate*, int, int, int, int);
+int evaluate_bitboard(Gamestate*, int, int);
+int evaluate_bits(unsigned int, unsigned int, unsigned int, unsigned int, int, int);
+void evaluate_batch(const struct packed*, int, int*);
+void evaluate_batch_scalar(const struct packed*, int, int*);
+#ifdef __AVX2__
+__m256i popcount_avx2(__m256i);
+void evaluate_batch_avx2(const struct packed*, int, int*);
+#endif
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+void evaluate_batch_avx512(const struct packed*, int, int*);
+#endif
+void evalcache_alloc();
+void evalcache_clear();
+void evalcache_free();
+int evaluate_patterns(Gamestate*, int, int);
+bool patterns_load(const char*);
+void patterns_free();
+bool weights_load(const char*);
+bool weights_save(const char*);
+void weights_changed();
+int evaluate_nnue(Gamestate*, int, int);
+bool nnue_load(const char*);
+void nnue_free();
+void nnue_transform_scalar(const short*, const short*, unsigned char*);
+void nnue_layer_scalar(const unsigned char*, int, const signed char*, const int*, int, int*);
+#ifdef __AVX2__
+void nnue_transform_avx2(const short*, const short*, unsigned char*);
+void nnue_layer_avx2(const unsigned char*, int, const signed char*, const int*, int, int*);
+#endif
+void lmr_init();
+void addkiller(struct stack*, int, int);
+void conthistory(struct info*, Gamestate*, int, int (*[2])[32]);
+int historyscore(struct info*, int (*[2])[32], int, int, int, int);
+void addhistory(struct info*, int (*[2])[32], int, int, int, int, int);
+struct tentry tentry_read(struct TEntry*);
+void tentry_write(struct TEntry*, u64, int, int, int, int, int, int);
+bool hashcheck(struct TEntry*, struct TEntry*, Gamestate*, int*, int*, int, int, int, int*, int*, int*);
+bool hashmove(struct TEntry*, struct TEntry*, Gamestate*, int*, int*);
+bool hashbound(struct TEntry*, struct TEntry*, u64, int, int, int, int*);
+bool hashentry(struct TEntry*, struct TEntry*, Gamestate*, int, int, int*, int*, int*);
+void hashstore(struct TEntry*, struct TEntry*, Gamestate*, int, int, int, int, int, Move);
+int negamax(Gamestate*, int, int, int, int, int, Move*, struct TEntry*, struct TEntry*, struct info*, struct timer*, int*, bool);
+int quiescence(Gamestate*, int, int, int, int, int, struct info*, struct timer*, int*);
+void pv_update(struct info*, int, Move*);
+void pv_store(Gamestate*, int, int, struct info*, struct TEntry*, struct TEntry*);
+void line_notation(Move*, int, char*, int);
+void searchroot(struct rootsearch*, struct rootworker*, int);
+void sort_rootmoves(struct rootmove*, int);
+void live_update(struct live*, int, int, int, double, char*);
+Move getbestmove(Gamestate*, int, char*, struct TEntry*, struct TEntry*, struct info*, struct timer*, int*, struct live*);
+Move getbestlines(Gamestate*, int, char*, struct TEntry*, struct TEntry*, struct info*, struct timer*, int*, struct live*, Movelist*);
+bool search_begin(struct search*);
+void search_join(struct search*);
+void search_abort(struct search*);
+void search_status(struct search*, struct searchinfo*);
+bool ponder_start(struct ponder*, Gamestate*, Move*, int, struct TEntry*, struct TEntry*, struct info*);
+bool ponder_finish(struct ponder*, Gamestate*, double, int*, Move*, int*, char*);
+bool ponder_reply(struct ponder*, int, int);
+void ponder_stop(struct ponder*);
 
 
 /**
@@ -77,38 +523,58 @@ int negamax(Gamestate*, int, int, int, int, int, Move*, struct TEntry*, struct T
  *  it uses iterative deepening to run the negamax search
  */
 Move getbestmove(
-	Gamestate *game, int color, double maxtime, char* str,
-	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* i, int* play, int* res
+	Gamestate *game, int color, char* str,
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* i, struct timer* timer, int* res, struct live* live
 ){
 
-	double start = (clock());
-
-	Move best, prev_best;
-	char movestr[200];
+	Move best = {0}, prev_best = {0};
+	char movestr[200], line[200] = "";
 
 	int eval = 0,
+		prev_eval = 0,
 		nodes = 0,
+		done = 0,
 		depth;
 
+	double iteration;
+
 	int c = (color == WHITE) ? -1 : 1;
 
+	run_once(&LMR_ONCE, lmr_init);
+	run_once(&EVALCACHE_ONCE, evalcache_alloc);
+
 	/* check if move is forced */
 	Movelist moves;
 	generate_all_moves(game, color == WHITE, &moves);
 
+	// the first move until an iteration finishes (the search can be stopped in the first one)
+	if (moves.length)
+		best = prev_best = moves.moves[0];
+
+	if (MULTIPV > 1 && moves.length > 1)
+		return getbestlines(game, color, str, TTable_deep, TTable_big, i, timer, res, live, &moves);
 
 	int beta = MATE*10, alpha = -beta, mn = alpha, mx = beta, phase;
 
 	/////////////////////////
 	// Iterative deepening //
 	/////////////////////////
-	for (depth = 1; depth < MAXDEPTH && ((clock()-start)/CLK_TCK < maxtime); depth += 1){
+	for (depth = 1; depth < MAXDEPTH && depth <= timer->maxdepth; depth += 1){
 
 		phase = 0,
-		prev_best = best;
+		prev_best = best,
+		prev_eval = eval;
+
+		iteration = clock_now();
 
 		search:
-			eval = negamax(game, depth, depth, c, alpha, beta, &best, TTable_deep, TTable_big, i, play, &nodes, true);
+			eval = negamax(game, 0, depth, c, alpha, beta, &best, TTable_deep, TTable_big, i, timer, &nodes, true);
+
+		// unfinished iteration, use the previous one (the first move at depth 1)
+		if (timer->stop){
+			best = prev_best, eval = prev_eval;
+			break;
+		}
 
 		///////////////////////
 		// Aspiration window //
@@ -124,20 +590,26 @@ Move getbestmove(
 		beta = eval + 100;
 
 
-		if ((abs(eval)>=MATE-MAXDEPTH && ((color==WHITE && eval>4000) || (color==BLACK && eval<-4000))) || *play){
+		if (abs(eval)>=MATE-MAXDEPTH && ((color==WHITE && eval>4000) || (color==BLACK && eval<-4000))){
 			if (depth > 1)
 				best = prev_best;
 		}
 
+		done = depth;
+
+		pv_store(game, c, depth, i, TTable_deep, TTable_big);
+		line_notation(i->pv_line, i->pv_moves, line, sizeof(line));
+		live_update(live, depth, eval, nodes, timer_elapsed(timer), line);
+
 		to_movenotation(&best, movestr);
-		sprintf(str, "... [%s] [depth %d] [eval %d] [%.2fs] [%d nodes]",
-			movestr, depth, eval, ((clock()-start)/CLK_TCK), nodes
+		sprintf(str, "... [%s] [depth %d] [eval %d] [%.2fs] [%d nodes] [pv %s]",
+			movestr, depth, eval, timer_elapsed(timer), nodes, line
 		);
 
-		// log("... [%s] [depth %d] [eval %d] [%.2fs] [%d nodes]\n",movestr, depth, eval, ((clock()-start)/CLK_TCK), nodes);
+		// log("... [%s] [depth %d] [eval %d] [%.2fs] [%d nodes]\n",movestr, depth, eval, timer_elapsed(timer), nodes);
 
 		// stop search ?
-		if (*play || abs(eval) >= MATE-MAXDEPTH || moves.length==1 || ((clock()-start)/CLK_TCK > maxtime)){
+		if (abs(eval) >= MATE-MAXDEPTH || moves.length==1 || !timer_next(timer, clock_now() - iteration)){
 			break;
 		}
 	}
@@ -145,8 +617,9 @@ Move getbestmove(
 	if (eval > 4000) *res = color == WHITE ? LOSS : WIN;
 	else if(eval < -4000) *res = color == BLACK ? LOSS: WIN;
 
-	sprintf(str, "\n[%s] [depth %d] [eval %d] [%.2fs] [%d nodes]",
-	    movestr, depth, eval, ((clock()-start)/CLK_TCK), nodes
+	to_movenotation(&best, movestr);
+	sprintf(str, "\n[%s] [depth %d] [eval %d] [%.2fs] [%d nodes] [pv %s]",
+	    movestr, done, eval, timer_elapsed(timer), nodes, line
 	);
 	// log("\n");
 
@@ -155,250 +628,1095 @@ Move getbestmove(
 
 
 /**
- * negamax search
+ * MultiPV search
+ *  get exact scores for the best `MULTIPV` root moves,
+ *  the root moves are shared among `THREADS` workers (same TTables)
  */
-int negamax(
-	Gamestate* game, int d, int depth, int color, int alpha, int beta, Move* best,
-	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* info, int* play, int* nodes, bool iid
-) {
-	Movelist moves;
-	generate_all_moves(game, color == -1, &moves); // 1 => BLACK{0}, -1 => WHITE{1}
+Move getbestlines(
+	Gamestate *game, int color, char* str,
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* info, struct timer* timer, int* res, struct live* live, Movelist* moves
+){
 
-	*nodes += 1;
+	struct rootmove list[MAXMOVES], prev[MAXMOVES];
+	char movestr[200];
 
-	if (*play || !moves.length || (depth<=0)) {
-		if (!moves.length) {
-			return -MATE + depth;
-		}
+	int n = moves->length,
+		lines = min(MULTIPV, n),
+		nworkers = THREADS < 1 ? 1 : min(THREADS, n),
+		nodes = 0,
+		done = 0,
+		depth, l, w;
 
-		if ((depth<=0) && moves.moves[0].is_capture){
-			depth = 1;
-		} else {
-			return color * evaluate(game, (color==-1)?WHITE:BLACK, depth);
-		}
-	}
+	double iteration;
 
-	int hash_flag, best_from=0, best_to=0, u, val;
+	struct rootworker* workers = malloc(nworkers * sizeof(struct rootworker));
 
-	// probe TTables
-	if (depth > 1 && hashcheck(TTable_deep, TTable_big, game, &alpha, &beta, depth, color, &val, &best_from, &best_to)){
-		return val;
+	for (w = 0; w < nworkers; w += 1){
+		workers[w].info = *info;
+		workers[w].info.cache_probes = workers[w].info.cache_hits = 0;
+		workers[w].info.lazy_evals = workers[w].info.lazy_exits = 0;
+		workers[w].nodes = 0;
 	}
 
-
-	/////////
-	// IID //
-	/////////
-	if (!(best_from || best_to) && iid && moves.length > 1) {
-		if (depth > 3){
-			negamax(game, d, depth-3, color, alpha, beta, best, TTable_deep, TTable_big, info, play, nodes, false);
-			hashcheck(TTable_deep, TTable_big, game, &u, &u, MAXDEPTH+1, color, &u, &best_from, &best_to);
-		}
+	for (l = 0; l < n; l += 1){
+		list[l] = (struct rootmove){moves->moves[l], 0, false, ""};
 	}
 
+	struct rootsearch rs = {
+		.game = game, .list = list,
+		.color = (color == WHITE) ? -1 : 1,
+		.TTable_deep = TTable_deep, .TTable_big = TTable_big, .timer = timer
+	};
 
-	///////////////////
-	// Move ordering //
-	///////////////////
-	int sortVals[moves.length];
+	/////////////////////////
+	// Iterative deepening //
+	/////////////////////////
+	for (depth = 1; depth < MAXDEPTH && depth <= timer->maxdepth; depth += 1){
+		memcpy(prev, list, sizeof(list));
 
-	Move move;
-	int frm, to, piece, mx=0;
+		iteration = clock_now();
 
-	if (moves.length > 1 && depth > 1){
-		one_capt counter_move = info->counterMoves[(color == -1)][game->prev_from][game->prev_to];
+		rs.depth = depth;
 
-		for (int i=0; i<moves.length; i+=1){
-			move = moves.moves[i], sortVals[i] = 0;
+		// candidates, full window
+		rs.first = 0, rs.last = lines, rs.full = true;
+		searchroot(&rs, workers, nworkers);
+		sort_rootmoves(list, lines);
 
-			frm = move.list[0].from,
-			to = move.list[move.length-1].to;
-			piece = game->board[frm].value;
+		// other moves, only need to know if they beat the weakest candidate
+		rs.first = lines, rs.last = n, rs.full = false, rs.bound = list[lines-1].eval;
+		searchroot(&rs, workers, nworkers);
+		sort_rootmoves(list, n);
 
-			if (frm == best_from && to == best_to){ // move from hashtable
-				sortVals[i] += 888888;
-			}
-			if ((piece & MAN) && ((to>=0&&to<=3&&color==-1) || (to>=28&&to<=31&&color==1))) { // promotion
-				sortVals[i] += 888880;
-			}
-			if (frm == counter_move.from && to == counter_move.to) { // counter-move heuristic
-				sortVals[i] += 777777;
-			}
-			if (frm == info->killer1_from[depth] && to == info->killer1_to[depth]) { // killer(primary)
-				sortVals[i] += 77777;
-			}
-			if (frm == info->killer2_from[depth] && to == info->killer2_to[depth]) { // killer(secondary)
-				sortVals[i] += 66666;
-			}
+		// unfinished iteration, use the previous one
+		if (timer->stop && depth > 1){
+			memcpy(list, prev, sizeof(list));
+			break;
+		}
 
-			sortVals[i] += info->History[frm][to];
+		done = depth;
 
-			mx = max(mx, sortVals[i]);
+		nodes = 0;
+		for (w = 0; w < nworkers; w += 1){
+			nodes += workers[w].nodes;
 		}
+		live_update(live, depth, list[0].eval, nodes, timer_elapsed(timer), list[0].pv);
 
-		if (mx > 0) {
-			sort_moves(moves.moves, sortVals, 0, moves.length-1);
+		// stop search ?
+		if (timer->stop || abs(list[0].eval) >= MATE-MAXDEPTH || !timer_next(timer, clock_now() - iteration)){
+			break;
 		}
 	}
 
+	nodes = 0;
+	for (w = 0; w < nworkers; w += 1){
+		nodes += workers[w].nodes;
 
-	////////////////
-	// Moves loop //
-	////////////////
-	int max = INT_MIN, a = alpha, b = beta, x, best_move_idx;
-	for (int i = 0; i < moves.length; i+=1){
-		move = moves.moves[i];
-		frm = move.list[0].from, to = move.list[move.length-1].to;	
+		info->cache_probes += workers[w].info.cache_probes;
+		info->cache_hits += workers[w].info.cache_hits;
+		info->lazy_evals += workers[w].info.lazy_evals;
+		info->lazy_exits += workers[w].info.lazy_exits;
+	}
+	free(workers);
 
-		if (i == 0){
-			best_move_idx = i;
-		}
+	int eval = list[0].eval;
 
-		domove(game, &move);
-			if (i == 0){
-				x = -negamax(game, d, depth-1, -color, -beta, -a, best, TTable_deep, TTable_big, info, play, nodes, iid);
-			} else {
-				// LMR
-				if (i > 3 && depth > 3 && beta-alpha <= 1) {
-					x = -negamax(game, d, depth-2, -color, -a-1, -a, best, TTable_deep, TTable_big, info, play, nodes, iid);
-				} else {
-					x = alpha + 1;
-				}
+	if (eval > 4000) *res = color == WHITE ? LOSS : WIN;
+	else if(eval < -4000) *res = color == BLACK ? LOSS: WIN;
 
-				if (x > alpha) {
-					// PVS
-					x = -negamax(game, d, depth-1, -color, -a-1, -a, best, TTable_deep, TTable_big, info, play, nodes, iid);
+	// report lines
+	int len = sprintf(str, "\n[depth %d] [%.2fs] [%d nodes]", done, timer_elapsed(timer), nodes);
 
-					if (a < x && x < b) {
-						// full depth search
-						x = -negamax(game, d, depth-1, -color, -beta, -a, best, TTable_deep, TTable_big, info, play, nodes, iid);
-					}
-				}
-			}
-		undomove(game, &move);
+	for (l = 0; l < lines && len < 900; l += 1){
+		to_movenotation(&list[l].move, movestr);
+		len += sprintf(str+len, "\n%d. [%s] [eval %d] [pv %s]", l+1, movestr, list[l].eval, list[l].pv);
+	}
 
-		if (x > max){
-			max = x;
-			best_move_idx = i;
-		}
+	return list[0].move;
+}
 
-		if (max >= b) {
-			best_move_idx = i;
-			addkiller(info, depth, frm, to);
-			break;
-		}
 
-		if (max > a) {
-			a = max;
-			best_move_idx = i;
-			addkiller(info, depth, frm, to);
-			addhistory(info, depth, frm, to, false);
-		}
-	}
+/**
+ * Root worker,
+ *  takes root moves from the shared list until all are searched
+ */
+THREAD_FUNC(rootworker_run, arg){
+	struct rootworker* worker = arg;
+	struct rootsearch* rs = worker->rs;
 
-	move = moves.moves[best_move_idx];
-	frm = move.list[0].from, to = move.list[move.length-1].to;
+	Gamestate game = *(rs->game);
+	Move move, best;
 
-	addhistory(info, depth, frm, to, true);
-	addcounter(info, color, game->prev_from, game->prev_to, frm, to);
+	int k, x, inf = MATE*10, d = rs->depth - 1;
+	bool exact;
 
-	// Add to TTable
-	hash_flag = ((max <= alpha) ? UPPER_BOUND : ((max >= beta) ? LOWER_BOUND : EXACT_SCORE));
-	hashstore(TTable_deep, TTable_big, game, depth, hash_flag, max, color, move);
+	while ((k = atomic_add(&rs->next, 1)) < rs->last){
+		move = rs->list[k].move;
 
-	if (d == depth)
-		*best = moves.moves[best_move_idx];
+		domove(&game, &move);
+			worker->info.stack[0].moved = PIECE_INDEX(game.board[game.prev_to].value) * 32 + game.prev_to;
 
-	return max;
+			if (rs->full){
+				x = -negamax(&game, 1, d, -rs->color, -inf, inf, &best, rs->TTable_deep, rs->TTable_big, &worker->info, rs->timer, &worker->nodes, true);
+				exact = true;
+			} else {
+				x = -negamax(&game, 1, d, -rs->color, -rs->bound-1, -rs->bound, &best, rs->TTable_deep, rs->TTable_big, &worker->info, rs->timer, &worker->nodes, true);
+				exact = false;
+
+				// beats a candidate, get the exact score
+				if (x > rs->bound){
+					x = -negamax(&game, 1, d, -rs->color, -inf, inf, &best, rs->TTable_deep, rs->TTable_big, &worker->info, rs->timer, &worker->nodes, true);
+					exact = true;
+				}
+			}
+		undomove(&game, &move);
+
+		rs->list[k].eval = x;
+		rs->list[k].exact = exact;
+
+		if (exact){
+			// the move, then the worker's line from ply 1
+			worker->info.pv[0][0] = move;
+			memcpy(&worker->info.pv[0][1], worker->info.pv[1], worker->info.pv_length[1] * sizeof(Move));
+			line_notation(worker->info.pv[0], worker->info.pv_length[1] + 1, rs->list[k].pv, sizeof(rs->list[k].pv));
+		}
+	}
+
+	THREAD_RETURN;
 }
 
 
 /**
- * Check if position exists in TTable
+ * Search the root moves `rs->first` to `rs->last`
+ *  with `n` workers, the calling thread is worker 0
  */
-bool hashcheck(
-	struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* game,
-	int* alpha, int* beta, int depth, int color, int* val, int* best_from, int* best_to
-){
-	u64 key = game->zobristKey;
-	int lock = key >> 32;
+void searchroot(struct rootsearch* rs, struct rootworker* workers, int n){
+	bool started[n];
 
-	struct TEntry* deep = &TTable_deep[key % DEEP_HASHTABLE_SIZE];
-	struct TEntry* big = &TTable_big[key % BIG_HASHTABLE_SIZE];
+	rs->next = rs->first;
 
-	if (!(big->occupied || deep->occupied || big->lock == lock || deep->lock == lock))
-		return false;
-
-	if (!deep->occupied) *best_from = big->move_from, *best_to = big->move_to;
-	else if (!big->occupied) *best_from = deep->move_from, *best_to = deep->move_to;
+	for (int w = 0; w < n; w += 1){
+		workers[w].rs = rs;
+	}
 
-	// the depth stored in the table is less than the remaining search depth
-	//  just get the move stored there (useful for move ordering)
-	if (depth > big->depth && depth > deep->depth){
-		if (big->depth > deep->depth){
-			*best_from = big->move_from;
-			*best_to = big->move_to;
-		} else {
-			*best_from = deep->move_from;
-			*best_to = deep->move_to;			
-		}
-		return false;
+	for (int w = 1; w < n; w += 1){
+		started[w] = thread_create(&workers[w].thread, rootworker_run, &workers[w]);
 	}
 
+	rootworker_run(&workers[0]);
 
-	/////////////////////
-	// deep hash table //
-	/////////////////////
-	if (deep->occupied && deep->lock == lock && deep->color == color && deep->key == key && deep->depth >= depth){
-		int v = deep->eval;
-			v += (abs(v) >= MATE-MAXDEPTH) ? ((v > 0)? -1 : 1) : 0;
+	for (int w = 1; w < n; w += 1){
+		if (started[w]) thread_join(workers[w].thread);
+	}
+}
 
-		*best_from = deep->move_from;
-		*best_to = deep->move_to;			
 
-		if (deep->flag == EXACT_SCORE) {
-			*val = v;
-			return true;
-		}
-		else if (deep->flag == LOWER_BOUND) {
-			if (v >= *beta) {
-				*val = v;
-				return true;
-			}
-			if (v > *alpha) {
-				*alpha = v;
-				return false;
-			}
-		}
-		else if (deep->flag == UPPER_BOUND) {
-			if (v <= *alpha) {
-				*val = v;
-				return true;
-			}
+/**
+ * Sort root moves by score (best first),
+ *  exact scores go before bounds of the same value
+ */
+void sort_rootmoves(struct rootmove* list, int n){
+	struct rootmove tmp;
+	int j;
 
-			if (v < *beta) {
-				*beta = v;
-				return false;
-			}
+	for (int i = 1; i < n; i += 1){
+		tmp = list[i];
+
+		for (j = i; j > 0; j -= 1){
+			if (list[j-1].eval > tmp.eval || (list[j-1].eval == tmp.eval && (list[j-1].exact || !tmp.exact)))
+				break;
+			list[j] = list[j-1];
 		}
+		list[j] = tmp;
 	}
+}
 
 
-	/////////////////////
-	// big hash table ///
-	/////////////////////
-	if (big->occupied  && big->lock == lock && big->color == color && big->key == key && big->depth >= depth){
-		int v = big->eval;
-			v += (abs(v) >= MATE-MAXDEPTH) ? ((v > 0)? -1 : 1) : 0;
+/**
+ * Publish the last finished iteration
+ */
+void live_update(struct live* live, int depth, int eval, int nodes, double time, char* pv){
+	if (!live)
+		return;
 
-		*best_from = big->move_from;
-		*best_to = big->move_to;
+	lock_acquire(&live->lock);
+		live->info.depth = depth;
+		live->info.eval = eval;
+		live->info.nodes = nodes;
+		live->info.time = time;
+		snprintf(live->info.pv, sizeof(live->info.pv), "%s", pv);
+	lock_release(&live->lock);
+}
 
-		if (big->flag == EXACT_SCORE) {
+
+/**
+ * Move notation of a line,
+ *  (comma separated, cut at the last move that fits in `size`)
+ */
+void line_notation(Move* line, int n, char* str, int size){
+	char movestr[200];
+	int len = 0, l;
+
+	str[0] = 0;
+
+	for (int i = 0; i < n; i += 1){
+		to_movenotation(&line[i], movestr);
+		l = strlen(movestr) + (i ? 2 : 0);
+
+		if (len + l >= size)
+			break;
+
+		len += snprintf(str+len, size-len, "%s%s", i ? ", " : "", movestr);
+	}
+}
+
+
+/**
+ * Search thread
+ */
+THREAD_FUNC(search_run, arg){
+	struct search* s = arg;
+
+	if (s->cpu >= 0)
+		thread_pin(s->cpu, NULL);
+
+	s->best = getbestmove(&s->game, s->color, s->str, s->TTable_deep, s->TTable_big, &s->info, &s->timer, &s->res, &s->live);
+
+	lock_acquire(&s->live.lock);
+		s->live.info.running = false;
+
+		if (s->stop_time > 0){
+			s->live.info.stop_latency = clock_now() - s->stop_time;
+		}
+	lock_release(&s->live.lock);
+
+	if (s->done)
+		s->done(s);
+
+	THREAD_RETURN;
+}
+
+
+/**
+ * Start searching `s->game` on a new thread,
+ *  the position, TTables, tables and timer must be set up by the caller
+ *
+ * returns false if the thread couldnt be started
+ */
+bool search_begin(struct search* s){
+	search_join(s);
+
+	s->res = UNKNOWN;
+	s->str[0] = 0;
+	s->play = 0;
+
+	lock_acquire(&s->live.lock);
+		s->live.info = (struct searchinfo){.running = true};
+		s->stop_time = 0;
+	lock_release(&s->live.lock);
+
+	s->active = thread_create(&s->thread, search_run, s);
+
+	if (!s->active){
+		lock_acquire(&s->live.lock);
+			s->live.info.running = false;
+		lock_release(&s->live.lock);
+	}
+
+	return s->active;
+}
+
+
+/**
+ * Wait for the search to return
+ */
+void search_join(struct search* s){
+	if (!s->active)
+		return;
+
+	thread_join(s->thread);
+	s->active = false;
+}
+
+
+/**
+ * Stop the search and wait for it,
+ *  the time it takes is kept as `stop_latency`
+ */
+void search_abort(struct search* s){
+	if (!s->active)
+		return;
+
+	lock_acquire(&s->live.lock);
+		if (s->live.info.running)
+			s->stop_time = clock_now();
+	lock_release(&s->live.lock);
+
+	atomic_set(&s->timer.stop, 1);
+
+	search_join(s);
+}
+
+
+/**
+ * Get the search progress
+ */
+void search_status(struct search* s, struct searchinfo* info){
+	lock_acquire(&s->live.lock);
+		*info = s->live.info;
+	lock_release(&s->live.lock);
+}
+
+
+/**
+ * Start pondering,
+ *  play our `best` move and the reply we expect (from the TTable),
+ *  then search the resulting position in the background
+ *
+ * returns false if there's nothing to ponder on
+ */
+bool ponder_start(
+	struct ponder* p, Gamestate* game, Move* best, int color,
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* info
+){
+	struct search* s = &p->search;
+	Movelist moves;
+	Move move = *best;
+	int from, to, k = 0;
+
+	search_abort(s);
+
+	s->game = *game;
+	domove(&s->game, &move);
+
+	// expected reply
+	generate_all_moves(&s->game, color == BLACK, &moves);
+
+	if (!moves.length)
+		return false;
+
+	if (moves.length > 1){
+		if (!hashmove(TTable_deep, TTable_big, &s->game, &from, &to))
+			return false;
+
+		for (k = 0; k < moves.length; k += 1){
+			move = moves.moves[k];
+			if (move.list[0].from == from && move.list[move.length-1].to == to)
+				break;
+		}
+
+		if (k == moves.length)
+			return false;
+	}
+
+	move = moves.moves[k];
+	p->reply_from = move.list[0].from;
+	p->reply_to = move.list[move.length-1].to;
+
+	domove(&s->game, &move);
+
+	generate_all_moves(&s->game, color == WHITE, &moves);
+
+	if (!moves.length)
+		return false;
+
+	s->color = color;
+	s->TTable_deep = TTable_deep;
+	s->TTable_big = TTable_big;
+	s->info = *info;
+	s->cpu = CPU;
+	s->done = NULL;
+
+	timer_start(&s->timer, 0, &s->play);
+	s->timer.ponder = 1;
+
+	return search_begin(s);
+}
+
+
+/**
+ * Opponent played `from`-`to` (squares 1-32),
+ *  returns true on a ponder hit (the search goes on),
+ *  else the ponder search is dropped
+ */
+bool ponder_reply(struct ponder* p, int from, int to){
+	if (!p->search.active)
+		return false;
+
+	if (from-1 == p->reply_from && to-1 == p->reply_to)
+		return true;
+
+	ponder_stop(p);
+	return false;
+}
+
+
+/**
+ * Use the ponder search if it's on the position in `game`,
+ *  it goes on as a normal search of `maxtime` seconds
+ *
+ * returns false (and drops the ponder search) if its a different position
+ */
+bool ponder_finish(struct ponder* p, Gamestate* game, double maxtime, int* play, Move* best, int* res, char* str){
+	struct search* s = &p->search;
+
+	if (!s->active)
+		return false;
+
+	if (s->game.zobristKey != game->zobristKey){
+		ponder_stop(p);
+		return false;
+	}
+
+	timer_ponderhit(&s->timer, maxtime, play);
+
+	search_join(s);
+
+	*best = s->best;
+	*res = s->res;
+	strcpy(str, s->str);
+
+	return true;
+}
+
+
+/**
+ * Stop and drop the ponder search
+ */
+void ponder_stop(struct ponder* p){
+	search_abort(&p->search);
+}
+
+
+/**
+ * Start timing a search of `maxtime` seconds
+ */
+void timer_start(struct timer* t, double maxtime, int* play){
+	t->start = clock_now();
+	t->soft = maxtime * SOFT_LIMIT;
+	t->hard = maxtime * HARD_LIMIT;
+	t->last = 0;
+	t->maxdepth = MAXDEPTH-1;
+
+	t->play = play;
+	t->stop = 0;
+	t->ponder = 0;
+}
+
+
+/**
+ * Ponder hit, the search becomes a normal
+ *  search of `maxtime` seconds from now
+ */
+void timer_ponderhit(struct timer* t, double maxtime, int* play){
+	t->start = clock_now();
+	t->soft = maxtime * SOFT_LIMIT;
+	t->hard = maxtime * HARD_LIMIT;
+
+	atomic_set(&t->play, play);
+	atomic_set(&t->ponder, 0);
+}
+
+
+/**
+ * Wall-clock seconds since the search started
+ */
+double timer_elapsed(struct timer* t){
+	return clock_now() - t->start;
+}
+
+
+/**
+ * Should the search stop ?
+ *  `playnow` and the hard limit are only polled every TIMER_NODES nodes
+ */
+inline bool timer_stopped(struct timer* t, int nodes){
+	if ((nodes & (TIMER_NODES-1)) == 0 && !atomic_get(&t->stop)){
+		if (atomic_get(atomic_get(&t->play)) || (!atomic_get(&t->ponder) && timer_elapsed(t) > t->hard))
+			atomic_set(&t->stop, 1);
+	}
+
+	return atomic_get(&t->stop);
+}
+
+
+/**
+ * Can we start another iteration ?
+ *  `iteration` is how long the last one took, the next one is
+ *  projected from how fast the iterations are growing
+ */
+bool timer_next(struct timer* t, double iteration){
+	double growth = (t->last > 0.001) ? iteration / t->last : 2;
+
+	growth = (growth < 1.5) ? 1.5 : ((growth > 4) ? 4 : growth);
+	t->last = iteration;
+
+	if (atomic_get(&t->stop) || atomic_get(atomic_get(&t->play)))
+		return false;
+
+	if (atomic_get(&t->ponder))
+		return true;
+
+	return timer_elapsed(t) + iteration * growth < t->soft;
+}
+
+
+/**
+ * negamax search
+ *  (excluded move in the stack => search the other moves, nothing is stored in the TTables)
+ */
+int negamax(
+	Gamestate* game, int ply, int depth, int color, int alpha, int beta, Move* best,
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, struct info* info, struct timer* timer, int* nodes, bool iid
+) {
+	Movelist moves;
+	struct stack* ss = &info->stack[ply];
+	Move* excluded = ss->excluded;
+
+	info->pv_length[ply] = 0;
+
+	// horizon, resolve the captures
+	if (depth <= 0)
+		return quiescence(game, ply, depth, color, alpha, beta, info, timer, nodes);
+
+	generate_all_moves(game, color == -1, &moves); // 1 => BLACK{0}, -1 => WHITE{1}
+
+	*nodes += 1;
+
+	if (!moves.length)
+		return -MATE + ply;
+
+	if (timer_stopped(timer, *nodes))
+		return color * evaluate_cached(game, (color==-1)?WHITE:BLACK, depth, alpha, beta, info);
+
+	// mate distance pruning, a shorter mate is already known
+	if (ply){
+		alpha = max(alpha, -MATE + ply);
+		beta = min(beta, MATE - ply - 1);
+
+		if (alpha >= beta)
+			return alpha;
+	}
+
+	int hash_flag, best_from=0, best_to=0, u, val, x;
+	int ex_from = -1, ex_to = -1;
+
+	// new node (the singular search keeps the static eval)
+	if (!excluded)
+		ss->static_eval = NO_EVAL;
+
+	// the children start with these
+	info->stack[ply+2].killers[0] = info->stack[ply+2].killers[1] = (one_capt){0};
+
+	if (excluded){
+		ex_from = excluded->list[0].from, ex_to = excluded->list[excluded->length-1].to;
+	}
+
+	// probe TTables
+	if (!excluded && depth >= HASH_MIN_DEPTH && hashcheck(TTable_deep, TTable_big, game, &alpha, &beta, depth, ply, color, &val, &best_from, &best_to)){
+		return val;
+	}
+
+
+	/////////////////////////////////////
+	// Enhanced transposition cutoffs  //
+	/////////////////////////////////////
+	if (ply && !excluded && ETC_DEPTH && depth >= ETC_DEPTH){
+		for (int i = 0; i < moves.length; i+=1){
+			// a child already refuted at this depth => fail high
+			if (hashbound(TTable_deep, TTable_big, movehashkey(game, &moves.moves[i]), depth-1, ply+1, -color, &val) && -val >= beta){
+				hashstore(TTable_deep, TTable_big, game, depth, ply, LOWER_BOUND, -val, color, moves.moves[i]);
+				return -val;
+			}
+		}
+	}
+
+
+	//////////////////////////////
+	// Razoring/Futility pruning //
+	//////////////////////////////
+	bool futile = false;
+
+	// (captures are forced, never prune them)
+	if (ply && depth <= FRONTIER_DEPTH && beta-alpha <= 1 && !moves.moves[0].is_capture && abs(alpha) < MATE-MAXDEPTH){
+		if (ss->static_eval == NO_EVAL)
+			ss->static_eval = color * evaluate_cached(game, (color==-1)?WHITE:BLACK, depth, -EVAL_INF, EVAL_INF, info);
+
+		int static_eval = ss->static_eval;
+
+		// hopeless, only check the quiescence search
+		if (!excluded && static_eval + RAZOR_MARGIN[depth] <= alpha){
+			x = quiescence(game, ply, 0, color, alpha, alpha+1, info, timer, nodes);
+
+			if (x <= alpha)
+				return x;
+		}
+
+		futile = static_eval + FUTILITY_MARGIN[depth] <= alpha;
+	}
+
+
+	/////////////
+	// ProbCut //
+	/////////////
+	if (ply && !excluded && PROBCUT_DEPTH && depth >= PROBCUT_DEPTH && beta-alpha <= 1 && abs(beta) < MATE-MAXDEPTH){
+		// shallow score the deep search would (likely) fail high with
+		int bound = (beta - PROBCUT_B + PROBCUT_T * PROBCUT_SIGMA) / PROBCUT_A + 1;
+
+		if (bound < MATE-MAXDEPTH){
+			x = negamax(game, ply, depth-PROBCUT_REDUCTION, color, bound-1, bound, best, TTable_deep, TTable_big, info, timer, nodes, false);
+			info->pv_length[ply] = 0;
+
+			if (x >= bound && !timer->stop)
+				return beta;
+		}
+	}
+
+
+	/////////
+	// IID //
+	/////////
+	if (!(best_from || best_to) && iid && !excluded && moves.length > 1) {
+		if (depth > 3){
+			negamax(game, ply, depth-3, color, alpha, beta, best, TTable_deep, TTable_big, info, timer, nodes, false);
+			hashcheck(TTable_deep, TTable_big, game, &u, &u, MAXDEPTH+1, ply, color, &u, &best_from, &best_to);
+			info->pv_length[ply] = 0;
+		}
+	}
+
+
+	/////////////////////////
+	// Singular extensions //
+	/////////////////////////
+	Move move;
+	bool singular = false;
+	int tt_val, tt_flag, tt_depth;
+
+	// the hash move fails high, do the others fail low by a margin ?
+	if (ply && !excluded && SE_DEPTH && depth >= SE_DEPTH && moves.length > 1 && ply+depth < MAXDEPTH-2
+		&& hashentry(TTable_deep, TTable_big, game, ply, color, &tt_val, &tt_flag, &tt_depth)
+		&& tt_flag != UPPER_BOUND && tt_depth >= depth-3 && abs(tt_val) < MATE-MAXDEPTH
+	){
+		int sbeta = tt_val - SE_MARGIN * depth;
+
+		for (int i = 0; i < moves.length; i+=1){
+			move = moves.moves[i];
+
+			if (move.list[0].from == best_from && move.list[move.length-1].to == best_to){
+				ss->excluded = &move;
+				x = negamax(game, ply, (depth-1)/2, color, sbeta-1, sbeta, best, TTable_deep, TTable_big, info, timer, nodes, false);
+				ss->excluded = NULL;
+				info->pv_length[ply] = 0;
+
+				singular = x < sbeta && !timer->stop;
+				break;
+			}
+		}
+	}
+
+
+	///////////////////
+	// Move ordering //
+	///////////////////
+	int sortVals[moves.length];
+
+	int frm, to, piece, pv_from=-1, pv_to=-1;
+	int (*cont[2])[32];
+
+	conthistory(info, game, ply, cont);
+
+	if (moves.length > 1 && depth > 1){
+
+		// on the last PV
+		if (ply < info->pv_moves && info->pv_keys[ply] == game->zobristKey){
+			move = info->pv_line[ply];
+			pv_from = move.list[0].from, pv_to = move.list[move.length-1].to;
+		}
+
+		for (int i=0; i<moves.length; i+=1){
+			move = moves.moves[i], sortVals[i] = 0;
+
+			frm = move.list[0].from,
+			to = move.list[move.length-1].to;
+			piece = game->board[frm].value;
+
+			if (frm == pv_from && to == pv_to){ // PV move
+				sortVals[i] += 999999;
+			}
+			if (frm == best_from && to == best_to){ // move from hashtable
+				sortVals[i] += 888888;
+			}
+			if ((piece & MAN) && ((to>=0&&to<=3&&color==-1) || (to>=28&&to<=31&&color==1))) { // promotion
+				sortVals[i] += 888880;
+			}
+			if (frm == ss->killers[0].from && to == ss->killers[0].to) { // killer(primary)
+				sortVals[i] += 77777;
+			}
+			if (frm == ss->killers[1].from && to == ss->killers[1].to) { // killer(secondary)
+				sortVals[i] += 66666;
+			}
+
+			sortVals[i] += historyscore(info, cont, color, piece, frm, to);
+		}
+
+		sort_moves(moves.moves, sortVals, 0, moves.length-1);
+	}
+
+
+	////////////////
+	// Moves loop //
+	////////////////
+	int max = INT_MIN, a = alpha, b = beta, best_move_idx = 0, r, e, h, searched = 0;
+	int tried[moves.length];   // moves searched, in order
+	bool promotion, lmp = ply && depth <= LMP_DEPTH && beta-alpha <= 1 && !moves.moves[0].is_capture && abs(alpha) < MATE-MAXDEPTH;
+
+	for (int i = 0; i < moves.length; i+=1){
+		move = moves.moves[i];
+		frm = move.list[0].from, to = move.list[move.length-1].to;	
+
+		if (i == 0){
+			best_move_idx = i;
+		}
+
+		if (frm == ex_from && to == ex_to){
+			continue;
+		}
+
+		piece = game->board[frm].value;
+		promotion = (piece & MAN) && ((to>=0&&to<=3&&color==-1) || (to>=28&&to<=31&&color==1));
+		h = historyscore(info, cont, color, piece, frm, to);
+
+		// the only good move, one ply deeper
+		e = singular && frm == best_from && to == best_to;
+
+		// cant reach alpha, skip quiet moves (not promotions)
+		if (futile && i > 0 && !promotion){
+			continue;
+		}
+
+		// late quiet move without history
+		if (lmp && i >= LMP_MOVES + depth*depth && !promotion && h < LMP_HISTORY){
+			continue;
+		}
+
+		tried[searched++] = i;
+
+		domove(game, &move);
+			ss->moved = PIECE_INDEX(game->board[to].value) * 32 + to;
+
+			if (i == 0){
+				x = -negamax(game, ply+1, depth-1+e, -color, -beta, -a, best, TTable_deep, TTable_big, info, timer, nodes, iid);
+			} else {
+				// LMR
+				r = 0;
+
+				if (i >= LMR_MOVES && depth >= LMR_DEPTH && beta-alpha <= 1 && !e) {
+					r = LMR_TABLE[min(depth, MAXDEPTH-1)][min(i, MAXMOVES-1)];
+					r -= h / LMR_HISTORY;
+					r = min(r, depth-1);
+				}
+
+				if (r > 0) {
+					x = -negamax(game, ply+1, depth-1-r, -color, -a-1, -a, best, TTable_deep, TTable_big, info, timer, nodes, iid);
+				} else {
+					x = alpha + 1;
+				}
+
+				if (x > alpha) {
+					// PVS
+					x = -negamax(game, ply+1, depth-1+e, -color, -a-1, -a, best, TTable_deep, TTable_big, info, timer, nodes, iid);
+
+					if (a < x && x < b) {
+						// full depth search
+						x = -negamax(game, ply+1, depth-1+e, -color, -beta, -a, best, TTable_deep, TTable_big, info, timer, nodes, iid);
+					}
+				}
+			}
+		undomove(game, &move);
+
+		if (x > max){
+			max = x;
+			best_move_idx = i;
+
+			if (max > a) // new best line
+				pv_update(info, ply, &moves.moves[i]);
+		}
+
+		if (max >= b) {
+			best_move_idx = i;
+			addkiller(ss, frm, to);
+
+			if (!excluded){
+				info->cutoffs += 1;
+				info->first_cutoffs += (i == 0);
+			}
+			break;
+		}
+
+		if (max > a) {
+			a = max;
+			best_move_idx = i;
+			addkiller(ss, frm, to);
+		}
+	}
+
+	// singular search, the result is only for the caller
+	if (excluded)
+		return (max == INT_MIN) ? alpha : max;
+
+	// aborted search, dont keep the result
+	if (timer->stop)
+		return max;
+
+	move = moves.moves[best_move_idx];
+
+	// reward the best move, penalize the ones searched before it
+	if (max > alpha){
+		int bonus = HISTORY_BONUS(depth);
+
+		for (int k = 0; k < searched; k+=1){
+			Move* m = &moves.moves[tried[k]];
+			frm = m->list[0].from, to = m->list[m->length-1].to;
+
+			addhistory(info, cont, color, game->board[frm].value, frm, to, (tried[k] == best_move_idx) ? bonus : -bonus);
+
+			if (tried[k] == best_move_idx) break;
+		}
+	}
+
+	// Add to TTable
+	hash_flag = ((max <= alpha) ? UPPER_BOUND : ((max >= beta) ? LOWER_BOUND : EXACT_SCORE));
+	hashstore(TTable_deep, TTable_big, game, depth, ply, hash_flag, max, color, move);
+
+	if (!ply)
+		*best = moves.moves[best_move_idx];
+
+	return max;
+}
+
+
+/**
+ * New best move at `ply`,
+ *  its line is the move then the line from `ply`+1
+ */
+inline void pv_update(struct info* info, int ply, Move* move){
+	int n = (ply+1 < MAXDEPTH) ? info->pv_length[ply+1] : 0;
+
+	info->pv[ply][0] = *move;
+	memcpy(&info->pv[ply][1], info->pv[ply+1], n * sizeof(Move));
+	info->pv_length[ply] = n + 1;
+}
+
+
+/**
+ * Keep the PV of a finished iteration,
+ *  its moves are searched first in the next one
+ *
+ * lines cut by TTable hits are continued with the hash moves,
+ *  up to `depth` moves
+ */
+void pv_store(Gamestate* game, int color, int depth, struct info* info, struct TEntry* TTable_deep, struct TEntry* TTable_big){
+	Movelist moves;
+	Move* move;
+	int n = info->pv_length[0], from, to, i, k;
+
+	for (i = 0; i < n; i += 1){
+		info->pv_line[i] = info->pv[0][i];
+		info->pv_keys[i] = game->zobristKey;
+		domove(game, &info->pv_line[i]);
+	}
+
+	for (; n < depth && hashmove(TTable_deep, TTable_big, game, &from, &to); n += 1){
+		generate_all_moves(game, (n & 1) ? color == 1 : color == -1, &moves);
+
+		move = NULL;
+
+		for (k = 0; k < moves.length; k += 1){
+			if (moves.moves[k].list[0].from == from && moves.moves[k].list[moves.moves[k].length-1].to == to){
+				move = &moves.moves[k];
+				break;
+			}
+		}
+		if (!move) break;
+
+		info->pv_line[n] = *move;
+		info->pv_keys[n] = game->zobristKey;
+		domove(game, &info->pv_line[n]);
+	}
+
+	for (i = n-1; i >= 0; i -= 1){
+		undomove(game, &info->pv_line[i]);
+	}
+
+	info->pv_moves = n;
+}
+
+
+/**
+ * Quiescence search
+ *  only captures (and promotions on the first ply), captures
+ *  are forced so the side to move can only stand pat without one
+ *
+ *  (nothing is stored in the TTables, `depth` <= 0)
+ */
+int quiescence(Gamestate* game, int ply, int depth, int color, int alpha, int beta, struct info* info, struct timer* timer, int* nodes){
+	Movelist moves;
+	generate_all_moves(game, color == -1, &moves);
+
+	*nodes += 1;
+
+	if (!moves.length)
+		return -MATE + ply;
+
+	bool capture = moves.moves[0].is_capture;
+	int best = INT_MIN, x;
+
+	if (timer_stopped(timer, *nodes) || (!capture && depth < 0))
+		return color * evaluate_cached(game, (color==-1)?WHITE:BLACK, depth, alpha, beta, info);
+
+	// stand pat
+	if (!capture){
+		best = color * evaluate_cached(game, (color==-1)?WHITE:BLACK, depth, alpha, beta, info);
+
+		if (best >= beta)
+			return best;
+
+		alpha = max(alpha, best);
+	}
+
+	// order by material won, promotions first
+	int sortVals[moves.length];
+	Move move;
+	int to, piece, n = 0;
+
+	for (int i = 0; i < moves.length; i+=1){
+		move = moves.moves[i], sortVals[i] = 0;
+
+		to = move.list[move.length-1].to;
+		piece = game->board[move.list[0].from].value;
+
+		if ((piece & MAN) && ((to>=0&&to<=3&&color==-1) || (to>=28&&to<=31&&color==1))) {
+			sortVals[i] += QS_PROMOTION;
+		}
+		if (capture){
+			for (int j = 0; j < move.length; j+=1)
+				sortVals[i] += (game->board[move.list[j].piece].value & KING) ? QS_KING : QS_MAN;
+		}
+
+		if (sortVals[i]) n++;
+		else sortVals[i] = -1;  // quiet move, skipped
+	}
+
+	// pick the best remaining move
+	for (int k, i = 0; i < n; i+=1){
+		k = 0;
+		for (int j = 1; j < moves.length; j+=1)
+			if (sortVals[j] > sortVals[k]) k = j;
+
+		sortVals[k] = -1;
+		move = moves.moves[k];
+
+		domove(game, &move);
+			x = -quiescence(game, ply+1, depth-1, -color, -beta, -alpha, info, timer, nodes);
+		undomove(game, &move);
+
+		if (x > best){
+			best = x;
+
+			if (best >= beta)
+				break;
+
+			alpha = max(alpha, best);
+		}
+	}
+
+	return best;
+}
+
+
+/**
+ * Check if position exists in TTable
+ */
+bool hashcheck(
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* game,
+	int* alpha, int* beta, int depth, int ply, int color, int* val, int* best_from, int* best_to
+){
+	u64 key = game->zobristKey;
+
+	struct tentry deep = tentry_read(&TTable_deep[key % DEEP_HASHTABLE_SIZE]);
+	struct tentry big = tentry_read(&TTable_big[key % BIG_HASHTABLE_SIZE]);
+
+	if (!(big.occupied || deep.occupied || big.key >> 32 == key >> 32 || deep.key >> 32 == key >> 32))
+		return false;
+
+	if (!deep.occupied) *best_from = big.move_from, *best_to = big.move_to;
+	else if (!big.occupied) *best_from = deep.move_from, *best_to = deep.move_to;
+
+	// the depth stored in the table is less than the remaining search depth
+	//  just get the move stored there (useful for move ordering)
+	if (depth > big.depth && depth > deep.depth){
+		if (big.depth > deep.depth){
+			*best_from = big.move_from;
+			*best_to = big.move_to;
+		} else {
+			*best_from = deep.move_from;
+			*best_to = deep.move_to;			
+		}
+		return false;
+	}
+
+
+	/////////////////////
+	// deep hash table //
+	/////////////////////
+	if (deep.occupied && deep.color == color && deep.key == key && deep.depth >= depth){
+		int v = score_from_tt(deep.eval, ply);
+
+		*best_from = deep.move_from;
+		*best_to = deep.move_to;			
+
+		if (deep.flag == EXACT_SCORE) {
+			*val = v;
+			return true;
+		}
+		else if (deep.flag == LOWER_BOUND) {
+			if (v >= *beta) {
+				*val = v;
+				return true;
+			}
+			if (v > *alpha) {
+				*alpha = v;
+				return false;
+			}
+		}
+		else if (deep.flag == UPPER_BOUND) {
+			if (v <= *alpha) {
+				*val = v;
+				return true;
+			}
+
+			if (v < *beta) {
+				*beta = v;
+				return false;
+			}
+		}
+	}
+
+
+	/////////////////////
+	// big hash table ///
+	/////////////////////
+	if (big.occupied  && big.color == color && big.key == key && big.depth >= depth){
+		int v = score_from_tt(big.eval, ply);
+
+		*best_from = big.move_from;
+		*best_to = big.move_to;
+
+		if (big.flag == EXACT_SCORE) {
 			*val = v;
 			return true;
 		}
-		else if (big->flag == LOWER_BOUND) {
+		else if (big.flag == LOWER_BOUND) {
 			if (v >= *beta) {
 				*val = v;
 				return true;
@@ -408,360 +1726,1189 @@ bool hashcheck(
 				return false;
 			}
 		}
-		else if (big->flag == UPPER_BOUND) {
+		else if (big.flag == UPPER_BOUND) {
 			if (v <= *alpha) {
 				*val = v;
 				return true;
 			}
 
-			if (v < *beta) {
-				*beta = v;
-				return false;
-			}
+			if (v < *beta) {
+				*beta = v;
+				return false;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Allocate (zeroed) TTables of the current size,
+ *  with NUMA set they go on the node of core `cpu`
+ *
+ * returns false if out of memory
+ */
+bool tables_alloc(struct TEntry** TTable_deep, struct TEntry** TTable_big, int cpu){
+	int node = (NUMA && cpu >= 0) ? cpu_node(cpu) : -1;
+
+	*TTable_deep = node_alloc(DEEP_HASHTABLE_SIZE * sizeof(struct TEntry), node);
+	*TTable_big = node_alloc(BIG_HASHTABLE_SIZE * sizeof(struct TEntry), node);
+
+	if (!*TTable_deep || !*TTable_big){
+		tables_free(*TTable_deep, *TTable_big);
+		*TTable_deep = *TTable_big = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Free TTables from tables_alloc()
+ */
+void tables_free(struct TEntry* TTable_deep, struct TEntry* TTable_big){
+	node_free(TTable_deep);
+	node_free(TTable_big);
+}
+
+
+/**
+ * Get the move stored for this exact position
+ *  (returns false if the position isnt in the TTables)
+ */
+bool hashmove(struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* game, int* from, int* to){
+	u64 key = game->zobristKey;
+
+	struct tentry deep = tentry_read(&TTable_deep[key % DEEP_HASHTABLE_SIZE]);
+	struct tentry big = tentry_read(&TTable_big[key % BIG_HASHTABLE_SIZE]);
+
+	if (deep.occupied && deep.key == key){
+		*from = deep.move_from, *to = deep.move_to;
+		return true;
+	}
+
+	if (big.occupied && big.key == key){
+		*from = big.move_from, *to = big.move_to;
+		return true;
+	}
+
+	return false;
+}
+
+
+/**
+ * Upper bound on the score of the position with hash `key`
+ *  (side to move there), from an entry searched to `depth` or deeper
+ */
+bool hashbound(struct TEntry* TTable_deep, struct TEntry* TTable_big, u64 key, int depth, int ply, int color, int* val){
+	struct tentry e[2] = {tentry_read(&TTable_deep[key % DEEP_HASHTABLE_SIZE]), tentry_read(&TTable_big[key % BIG_HASHTABLE_SIZE])};
+
+	for (int i = 0; i < 2; i += 1){
+		if (e[i].occupied && e[i].key == key && e[i].color == color && e[i].depth >= depth && e[i].flag != LOWER_BOUND){
+			*val = score_from_tt(e[i].eval, ply);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * Score, flag and depth stored for the position
+ *  (the deeper entry of the two TTables)
+ */
+bool hashentry(struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* game, int ply, int color, int* val, int* flag, int* depth){
+	u64 key = game->zobristKey;
+
+	struct tentry e[2] = {tentry_read(&TTable_deep[key % DEEP_HASHTABLE_SIZE]), tentry_read(&TTable_big[key % BIG_HASHTABLE_SIZE])};
+	struct tentry* found = NULL;
+
+	for (int i = 0; i < 2; i += 1){
+		if (e[i].occupied && e[i].key == key && e[i].color == color && (!found || e[i].depth > found->depth))
+			found = &e[i];
+	}
+
+	if (!found)
+		return false;
+
+	*val = score_from_tt(found->eval, ply);
+	*flag = found->flag;
+	*depth = found->depth;
+	return true;
+}
+
+
+/**
+ * Store position in TTable
+ */
+void hashstore(
+	struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* g,
+	int depth, int ply, int flag, int eval, int color, Move move
+){
+	int index = g->zobristKey % DEEP_HASHTABLE_SIZE;
+
+	if (depth < HASH_MIN_DEPTH){
+		return;
+	}
+
+	eval = score_to_tt(eval, ply);
+
+	int move_from = move.list[0].from,
+		move_to  = move.list[move.length-1].to;
+
+	struct tentry deep = tentry_read(&TTable_deep[index]);
+
+	// Spot empty, add the position
+	//  else replace the entry if new depth is same or deeper, else add to big hashtable
+	if (!deep.occupied || depth >= deep.depth){
+		tentry_write(&TTable_deep[index], g->zobristKey, eval, flag, depth, color, move_from, move_to);
+	}
+	else {
+		// add position to big hash table
+		index = g->zobristKey % BIG_HASHTABLE_SIZE;
+
+		tentry_write(&TTable_big[index], g->zobristKey, eval, flag, depth, color, move_from, move_to);
+	}
+}
+
+
+/**
+ * Read a TTable slot,
+ *  `key` is the position's only if the two words are from the same write
+ */
+inline struct tentry tentry_read(struct TEntry* slot){
+	u64 key = atomic_get(&slot->key),
+		data = atomic_get(&slot->data);
+
+	return (struct tentry) {
+		.key = key ^ data,
+		.eval = (short) (data & 0xFFFF),
+		.flag = (data >> 16) & 3,
+		.depth = (data >> 18) & 127,
+		.color = ((data >> 25) & 1) ? 1 : -1,
+		.occupied = (data >> 26) & 1,
+		.move_from = (data >> 27) & 31,
+		.move_to = (data >> 32) & 31
+	};
+}
+
+
+/**
+ * Write an entry to a TTable slot
+ *  (eval 16 bits, flag 2, depth 7, color 1 => +1, squares 5 each)
+ */
+inline void tentry_write(struct TEntry* slot, u64 key, int eval, int flag, int depth, int color, int move_from, int move_to){
+	u64 data = (u64) (unsigned short) eval
+		| (u64) flag << 16
+		| (u64) depth << 18
+		| (u64) (color == 1) << 25
+		| (u64) 1 << 26
+		| (u64) move_from << 27
+		| (u64) move_to << 32;
+
+	atomic_set(&slot->key, key ^ data);
+	atomic_set(&slot->data, data);
+}
+
+
+/**
+ * Fill the LMR table
+ *  (at least one ply once a move is reduced),
+ *  searches read it, so none may be running
+ */
+void lmr_init(){
+	for (int d = 1; d < MAXDEPTH; d += 1){
+		for (int i = 1; i < MAXMOVES; i += 1){
+			LMR_TABLE[d][i] = max(1, (int) (LMR_BASE + 10000 * log2(d) * log2(i) / LMR_DIV) / 100);
+		}
+	}
+}
+
+
+/**
+ * Add a killer move
+ *  move primary to secondaray
+ *  then add new move to primary
+ */
+inline void addkiller(struct stack* ss, int from, int to){
+	if (from != ss->killers[0].from || to != ss->killers[0].to){
+		ss->killers[1] = ss->killers[0];
+		ss->killers[0] = C(from, 0, to);
+	}
+}
+
+
+/**
+ * Continuation history rows of a node,
+ *  cont[0] after the last move, cont[1] after the one before it
+ *  (NULL if that move isnt known)
+ */
+inline void conthistory(struct info* info, Gamestate* game, int ply, int (*cont[2])[32]){
+	int v = game->board[game->prev_to].value;
+
+	cont[0] = (game->prev_from != game->prev_to && (v & (MAN|KING)))
+		? info->ContHistory[0][PIECE_INDEX(v)][game->prev_to] : NULL;
+
+	cont[1] = (ply >= 2)
+		? info->ContHistory[1][info->stack[ply-2].moved / 32][info->stack[ply-2].moved % 32] : NULL;
+}
+
+
+/**
+ * History score of a move,
+ *  butterfly + continuation histories
+ */
+inline int historyscore(struct info* info, int (*cont[2])[32], int color, int piece, int frm, int to){
+	int p = PIECE_INDEX(piece),
+		h = info->History[(color == -1)][frm][to];
+
+	if (cont[0]) h += cont[0][p][to];
+	if (cont[1]) h += cont[1][p][to];
+
+	return h;
+}
+
+
+/**
+ * Add `bonus` (< 0 => penalty) to the history scores of a move
+ */
+#define gravity(h, bonus) ((h) += (bonus) - (h) * abs(bonus) / HISTORY_MAX)
+
+inline void addhistory(struct info* info, int (*cont[2])[32], int color, int piece, int frm, int to, int bonus){
+	int p = PIECE_INDEX(piece);
+
+	gravity(info->History[(color == -1)][frm][to], bonus);
+
+	if (cont[0]) gravity(cont[0][p][to], bonus);
+	if (cont[1]) gravity(cont[1][p][to], bonus);
+}
+
+
+// bits 0..3 reversed, black's back rank (squares 1..4) as a back rank values index
+const int REVERSE4[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+
+// board halves as bitboards (see HALF())
+#define LEFT_SQUARES 0xCCCCCCCCu
+#define RIGHT_SQUARES 0x33333333u
+
+// men structure terms of evaluate() (see evaluate_structure()), direct mapped by the
+//  men's zobrist key, an entry is the key's high 32 bits (low bit set) << 32 | the terms
+#define STRUCTURE_SIZE 16384   // entries, a power of 2 (128kb)
+
+u64 STRUCTURE[STRUCTURE_SIZE];
+
+
+/**
+ * (Re)allocate the eval cache
+ *  if EVALCACHE_KB changed, the biggest power of 2 entries that fit,
+ *  searches probe it, so none may be running
+ */
+void evalcache_alloc(){
+	unsigned int size = 0;
+
+	if (EVALCACHE_KB > 0)
+		for (size = 1; size * 2 * sizeof(u64) <= EVALCACHE_KB * 1024UL; size *= 2);
+
+	if (size == EVALCACHE_SIZE)
+		return;
+
+	evalcache_free();
+
+	if (size && (EVALCACHE = calloc(size, sizeof(u64))))
+		EVALCACHE_SIZE = size;
+}
+
+
+/**
+ * Forget the cached scores
+ *  (the evaluator changed)
+ */
+void evalcache_clear(){
+	if (EVALCACHE)
+		memset(EVALCACHE, 0, EVALCACHE_SIZE * sizeof(u64));
+}
+
+
+/**
+ * Free the eval cache
+ */
+void evalcache_free(){
+	free(EVALCACHE);
+
+	EVALCACHE = NULL;
+	EVALCACHE_SIZE = 0;
+}
+
+
+/**
+ * evaluate() through the eval cache, counting the probes in `info`
+ *  (mate scores depend on `depth`, theyre not stored, and the
+ *   cached evaluators have no lazy exits, only exact scores are)
+ */
+int evaluate_cached(Gamestate* game, int color, int depth, int alpha, int beta, struct info* info){
+	if (!EVALCACHE || (EVAL == EVAL_PATTERNS ? !PATTERNS : EVAL == EVAL_NNUE ? !NNUE.file : true))
+		return evaluate(game, color, depth, alpha, beta, info);
+
+	u64 key = game->zobristKey ^ ((color == BLACK) ? EVALCACHE_BLACK : 0);
+	u64* e = &EVALCACHE[key & (EVALCACHE_SIZE-1)];
+	u64 entry = atomic_get(e);    // (once, the search threads share the cache)
+
+	unsigned int lock = (key >> 32) | 1;
+	int eval;
+
+	info->cache_probes += 1;
+
+	if ((entry >> 32) == lock){
+		info->cache_hits += 1;
+		return (int) (unsigned int) entry;
+	}
+
+	eval = evaluate(game, color, depth, alpha, beta, info);
+
+	if (abs(eval) < MATE-MAXDEPTH)
+		atomic_set(e, (u64) lock << 32 | (unsigned int) eval);
+
+	return eval;
+}
+
+
+/**
+ * Return Heuristic evaluation value of position
+ *  (material and piece-square terms are kept in `game` by domove()/undomove())
+ *
+ * `alpha`, `beta` => search window of `color`, far outside it only a bound
+ *  from the material and king terms is returned (<= alpha or >= beta),
+ *  counted in `info` (may be NULL)
+ */
+int evaluate(Gamestate* game, int color, int depth, int alpha, int beta, struct info* info) {
+	int eval;
+	int v1, v2;
+	int nbm, nbk, nwm, nwk;
+	int nbml, nwml;  // men on left side
+	int nbmr, nwmr;  // men on right side
+
+	int code, structure, lazy;
+
+	field * b = game->board;
+	u64* e, entry;
+
+#ifdef EVAL_CHECK
+	// incremental terms must match a full recompute
+	Gamestate full = *game;
+	init_eval_terms(&full);
+
+	if (full.code[0] != game->code[0] || full.code[1] != game->code[1] || full.psq != game->psq || full.menKey != game->menKey
+		|| memcmp(full.pattern, game->pattern, sizeof(full.pattern))
+		|| memcmp(full.accumulator, game->accumulator, sizeof(full.accumulator))
+		|| memcmp(full.bitboard, game->bitboard, sizeof(full.bitboard))
+	){
+		fprintf(stderr, "evaluate(): incremental terms differ from the board\n");
+		abort();
+	}
+#endif
+
+	if (EVAL == EVAL_PATTERNS && PATTERNS)
+		return evaluate_patterns(game, color, depth);
+
+	if (EVAL == EVAL_NNUE && NNUE.file)
+		return evaluate_nnue(game, color, depth);
+
+	if (EVAL == EVAL_BITBOARD)
+		return evaluate_bitboard(game, color, depth);
+
+	// left/right side pieces
+	code = game->code[0];
+
+	nwml = code % 16;
+	nbml = (code >> 8) % 16;
+	nwk = (code >> 4) % 16;
+	nbk = (code >> 12) % 16;
+
+	code = game->code[1];
+
+	nwmr = code % 16;
+	nbmr = (code >> 8) % 16;
+	nwk += (code >> 4) % 16;
+	nbk += (code >> 12) % 16;
+
+	nbm = nbml + nbmr;
+	nwm = nwml + nwmr;
+
+	v1 = WEIGHTS.man*nbm + WEIGHTS.king*nbk;
+	v2 = WEIGHTS.man*nwm + WEIGHTS.king*nwk;
+
+	if (v1 == 0 || v2 == 0)
+		return -MATE+depth;
+
+	eval = v1 - v2;                                   /*material values*/
+	eval += (WEIGHTS.exchange * (v1-v2)) / (v1+v2);   /*favor exchanges if in material plus*/
+	eval += (color == BLACK) ? WEIGHTS.turn : -WEIGHTS.turn;
+
+											/* king's balance         */
+	if ((nbk == 0) && (nwk != 0))
+		eval -= WEIGHTS.king_balance;
+	if ((nbk != 0 ) && (nwk == 0))
+		eval += WEIGHTS.king_balance;
+
+	// lazy exit, (score of `color` like the window)
+	lazy = (color == BLACK) ? eval : -eval;
+	if (info) info->lazy_evals += 1;
+
+	if (lazy + LAZY_MARGIN <= alpha || lazy - LAZY_MARGIN >= beta){
+		if (info) info->lazy_exits += 1;
+
+		lazy += (lazy + LAZY_MARGIN <= alpha) ? LAZY_MARGIN : -LAZY_MARGIN;
+
+#ifdef EVAL_CHECK
+		// (the bound must hold)
+		int exact = evaluate(game, color, depth, -EVAL_INF, EVAL_INF, NULL);
+
+		if (abs(exact - eval) > LAZY_MARGIN){
+			fprintf(stderr, "evaluate(): positional terms over LAZY_MARGIN\n");
+			abort();
 		}
+#endif
+
+		return (color == BLACK) ? lazy : -lazy;
 	}
 
-	return false;
+	/* men structure, cached by the men's key */
+	e = &STRUCTURE[game->menKey & (STRUCTURE_SIZE-1)];
+	entry = atomic_get(e);    // (once, the search threads share the cache)
+
+	if ((entry >> 32) == ((game->menKey >> 32) | 1)){
+		structure = (int) (unsigned int) entry;
+	} else {
+		structure = evaluate_structure(game, nbml, nbmr, nwml, nwmr);
+		atomic_set(e, ((game->menKey >> 32) | 1) << 32 | (unsigned int) structure);
+	}
+
+	eval += structure;
+
+	// (these see the kings too)
+
+	// square c5
+	if (b[13].value == (WHITE|MAN) && b[12].value == FREE)
+		eval += WEIGHTS.c5;
+
+	if (b[18].value == (BLACK|MAN) && b[19].value == FREE)
+		eval -= WEIGHTS.c5;
+
+	// square e5
+	if (b[17].value == (BLACK|MAN)) {
+		if (nbm+nbk+nwm+nwk > 16) eval -= WEIGHTS.e5;
+		else eval += WEIGHTS.e5;
+	}
+
+	if (b[14].value == (WHITE|MAN)) {
+		if (nbm+nbk+nwm+nwk > 16) eval += WEIGHTS.e5;
+		else eval -= WEIGHTS.e5;
+	}
+
+	return eval;
 }
 
 
 /**
- * Store position in TTable
+ * Terms of evaluate() that depend only on the men,
+ *  (`nbml`.. => black/white men on the left/right side)
  */
-void hashstore(
-	struct TEntry* TTable_deep, struct TEntry* TTable_big, Gamestate* g,
-	int depth, int flag, int eval, int color, Move move
-){
-	int index = g->zobristKey % DEEP_HASHTABLE_SIZE;
+int evaluate_structure(Gamestate* game, int nbml, int nbmr, int nwml, int nwmr){
+	int eval = 0, code, backrank;
 
-	if (depth <= 1){
-		return;
-	}
+	field * b = game->board;
 
-	int move_from = move.list[0].from,
-		move_to  = move.list[move.length-1].to;
+											/* balance                */
+	eval -= abs(nbml - nbmr) * WEIGHTS.balance;
+	eval += abs(nwml - nwmr) * WEIGHTS.balance;
 
-	// Spot empty, add the position
-	if (!TTable_deep[index].occupied){
+	code = 0;
+	if(b[3].value & MAN) code += 1;
+	if(b[2].value & MAN) code += 2;
+	if(b[1].value & MAN) code += 4; // Golden checker
+	if(b[0].value & MAN) code += 8;
+
+	backrank = WEIGHTS.backrank_values[code];
+
+	code=0;
+	if(b[31].value & MAN) code += 8;
+	if(b[30].value & MAN) code += 4; // Golden checker
+	if(b[29].value & MAN) code += 2;
+	if(b[28].value & MAN) code += 1;
+
+	backrank -= WEIGHTS.backrank_values[code];
+	eval += WEIGHTS.backrank * backrank;
+
+	/* center control, edges, squares c5, f6, d6 */
+	eval += game->psq;
+
+	return eval;
+}
+
+
+/**
+ * evaluate() without data dependent branches (same scores, no lazy exit),
+ *  see evaluate_bits()
+ */
+int evaluate_bitboard(Gamestate* game, int color, int depth){
+	return evaluate_bits(game->bitboard[0], game->bitboard[1], game->bitboard[2], game->bitboard[3], color, depth);
+}
+
+
+/**
+ * evaluate_bitboard() of the white/black men and kings bitboards,
+ *  counts are popcounts of the bitboards, the back rank and piece-square
+ *  terms come from tables indexed by bits of the men, conditions are 0/1 factors
+ */
+int evaluate_bits(unsigned int wm, unsigned int wk, unsigned int bm, unsigned int bk, int color, int depth){
+	unsigned int men = wm | bm,
+		empty = ~(men | wk | bk);
+
+	int nwml = popcount(wm & LEFT_SQUARES), nwmr = popcount(wm & RIGHT_SQUARES),
+		nbml = popcount(bm & LEFT_SQUARES), nbmr = popcount(bm & RIGHT_SQUARES),
+		nwk = popcount(wk), nbk = popcount(bk),
+		nwm = nwml + nwmr, nbm = nbml + nbmr;
+
+	int v1 = WEIGHTS.man*nbm + WEIGHTS.king*nbk,
+		v2 = WEIGHTS.man*nwm + WEIGHTS.king*nwk,
+		none = (v1 == 0) | (v2 == 0),               // a side without pieces
+		opening = (nbm+nbk+nwm+nwk > 16),
+		eval;
+
+	eval = v1 - v2;
+	eval += (WEIGHTS.exchange * (v1-v2)) / (v1+v2 + none);    // (cant divide by 0, the score is dropped then)
+	eval += WEIGHTS.turn - 2*WEIGHTS.turn * (color != BLACK);
+
+	// balance, king's balance
+	eval -= abs(nbml - nbmr) * WEIGHTS.balance;
+	eval += abs(nwml - nwmr) * WEIGHTS.balance;
+	eval += WEIGHTS.king_balance * (((nbk != 0) & (nwk == 0)) - ((nbk == 0) & (nwk != 0)));
 
-		TTable_deep[index].eval = eval;
-		TTable_deep[index].flag = flag;
-		TTable_deep[index].move_from = move_from;
-		TTable_deep[index].move_to = move_to;
-		TTable_deep[index].depth = depth;
-		TTable_deep[index].color = color;
+	// back rank, squares 1..4 and 29..32
+	eval += WEIGHTS.backrank * (WEIGHTS.backrank_values[REVERSE4[men & 15]] - WEIGHTS.backrank_values[men >> 28]);
 
-		TTable_deep[index].occupied = true;
-		TTable_deep[index].key = g->zobristKey;
-		TTable_deep[index].lock = g->zobristKey >> 32;
+	// center control, edges, squares c5, f6, d6
+	for (int k = 0; k < 4; k += 1)
+		eval += PSQ_BYTES[0][k][(wm >> 8*k) & 255] + PSQ_BYTES[1][k][(bm >> 8*k) & 255];
+
+	// square c5
+	eval += WEIGHTS.c5 * (int) ((wm >> 13) & (empty >> 12) & 1);
+	eval -= WEIGHTS.c5 * (int) ((bm >> 18) & (empty >> 19) & 1);
+
+	// square e5
+	eval += (int) ((bm >> 17) & 1) * (WEIGHTS.e5 - 2*WEIGHTS.e5 * opening);
+	eval += (int) ((wm >> 14) & 1) * (2*WEIGHTS.e5 * opening - WEIGHTS.e5);
+
+	return eval + none * (-MATE+depth - eval);
+}
+
+
+/**
+ * Evaluate `n` packed positions into `scores`,
+ *  scores of the handwritten evaluator, same as evaluate() of the
+ *  unpacked position with its side to move (depth 0, no lazy exit)
+ */
+void evaluate_batch(const struct packed* positions, int n, int* scores){
+	int vector = n - n % BATCH_LANES;
+
+	evaluate_batch_kernel(positions, vector, scores);
+	evaluate_batch_scalar(positions + vector, n - vector, scores + vector);
+}
+
+
+/**
+ * evaluate_batch(), one position at a time
+ */
+void evaluate_batch_scalar(const struct packed* positions, int n, int* scores){
+	const struct packed* p;
+
+	for (int i = 0; i < n; i += 1){
+		p = &positions[i];
+
+		scores[i] = evaluate_bits(
+			p->white & ~p->kings, p->white & p->kings, p->black & ~p->kings, p->black & p->kings,
+			p->turn ? WHITE : BLACK, 0
+		);
 	}
-	else {
-		// Spot not empty, replace entry if new depth is same or deeper else add to big hashtable
+}
+
+
+#ifdef __AVX2__
+/**
+ * Bits set in each 32 bit lane,
+ *  (bytes counted with a nibble table, then summed)
+ */
+inline __m256i popcount_avx2(__m256i x){
+	const __m256i table = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4),
+		nibble = _mm256_set1_epi8(0x0F);
+
+	__m256i bytes = _mm256_add_epi8(
+		_mm256_shuffle_epi8(table, _mm256_and_si256(x, nibble)),
+		_mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble))
+	);
+
+	return _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, _mm256_set1_epi8(1)), _mm256_set1_epi16(1));
+}
+
+
+/**
+ * evaluate_bits() of 8 positions a pass (n a multiple of 8),
+ *  the tables are gathered, the exchange term is divided in doubles
+ *  (exact, the quotient is truncated like the integer one)
+ */
+void evaluate_batch_avx2(const struct packed* positions, int n, int* scores){
+	int backrank_black[16], backrank_white[16];
 
-		if (depth >= TTable_deep[index].depth){
+	for (int i = 0; i < 16; i += 1){
+		backrank_black[i] = WEIGHTS.backrank * WEIGHTS.backrank_values[REVERSE4[i]];
+		backrank_white[i] = WEIGHTS.backrank * WEIGHTS.backrank_values[i];
+	}
 
-			TTable_deep[index].eval = eval;
-			TTable_deep[index].flag = flag;
-			TTable_deep[index].move_from = move_from;
-			TTable_deep[index].move_to = move_to;
-			TTable_deep[index].depth = depth;
-			TTable_deep[index].color = color;
-			TTable_deep[index].lock = g->zobristKey >> 32;
+	const __m256i fields = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28),   // (a struct packed is 4 ints)
+		one = _mm256_set1_epi32(1), zero = _mm256_setzero_si256(),
+		man = _mm256_set1_epi32(WEIGHTS.man), king = _mm256_set1_epi32(WEIGHTS.king),
+		exchange = _mm256_set1_epi32(WEIGHTS.exchange), balance = _mm256_set1_epi32(WEIGHTS.balance),
+		king_balance = _mm256_set1_epi32(WEIGHTS.king_balance),
+		turn = _mm256_set1_epi32(WEIGHTS.turn), turn2 = _mm256_set1_epi32(2*WEIGHTS.turn),
+		c5 = _mm256_set1_epi32(WEIGHTS.c5), e5 = _mm256_set1_epi32(WEIGHTS.e5), e52 = _mm256_set1_epi32(2*WEIGHTS.e5),
+		left = _mm256_set1_epi32(LEFT_SQUARES), right = _mm256_set1_epi32(RIGHT_SQUARES),
+		bytes = _mm256_set1_epi32(255), nibble = _mm256_set1_epi32(15);
+
+	for (int i = 0; i < n; i += 8){
+		const int* p = (const int*) (positions + i);
+
+		__m256i black = _mm256_i32gather_epi32(p, fields, 4),
+			white = _mm256_i32gather_epi32(p + 1, fields, 4),
+			kings = _mm256_i32gather_epi32(p + 2, fields, 4),
+			white_moves = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_i32gather_epi32(p + 3, fields, 4), bytes), one);
+
+		__m256i wm = _mm256_andnot_si256(kings, white), wk = _mm256_and_si256(kings, white),
+			bm = _mm256_andnot_si256(kings, black), bk = _mm256_and_si256(kings, black),
+			men = _mm256_or_si256(wm, bm),
+			empty = _mm256_xor_si256(_mm256_or_si256(black, white), _mm256_set1_epi32(-1));
+
+		__m256i nwml = popcount_avx2(_mm256_and_si256(wm, left)), nwmr = popcount_avx2(_mm256_and_si256(wm, right)),
+			nbml = popcount_avx2(_mm256_and_si256(bm, left)), nbmr = popcount_avx2(_mm256_and_si256(bm, right)),
+			nwk = popcount_avx2(wk), nbk = popcount_avx2(bk),
+			nwm = _mm256_add_epi32(nwml, nwmr), nbm = _mm256_add_epi32(nbml, nbmr);
+
+		__m256i v1 = _mm256_add_epi32(_mm256_mullo_epi32(man, nbm), _mm256_mullo_epi32(king, nbk)),
+			v2 = _mm256_add_epi32(_mm256_mullo_epi32(man, nwm), _mm256_mullo_epi32(king, nwk)),
+			none = _mm256_or_si256(_mm256_cmpeq_epi32(v1, zero), _mm256_cmpeq_epi32(v2, zero)),
+			opening = _mm256_cmpgt_epi32(_mm256_add_epi32(_mm256_add_epi32(nbm, nbk), _mm256_add_epi32(nwm, nwk)), _mm256_set1_epi32(16)),
+			eval = _mm256_sub_epi32(v1, v2);
+
+		// exchanges, (v1+v2 - none) is never 0
+		__m256i num = _mm256_mullo_epi32(exchange, eval), den = _mm256_sub_epi32(_mm256_add_epi32(v1, v2), none);
+
+		__m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(
+				_mm256_cvtepi32_pd(_mm256_castsi256_si128(num)), _mm256_cvtepi32_pd(_mm256_castsi256_si128(den)))),
+			hi = _mm256_cvttpd_epi32(_mm256_div_pd(
+				_mm256_cvtepi32_pd(_mm256_extracti128_si256(num, 1)), _mm256_cvtepi32_pd(_mm256_extracti128_si256(den, 1))));
+
+		eval = _mm256_add_epi32(eval, _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+
+		// color to move
+		eval = _mm256_add_epi32(eval, _mm256_sub_epi32(turn, _mm256_and_si256(white_moves, turn2)));
+
+		// balance, king's balance
+		eval = _mm256_add_epi32(eval, _mm256_mullo_epi32(balance, _mm256_sub_epi32(
+			_mm256_abs_epi32(_mm256_sub_epi32(nwml, nwmr)), _mm256_abs_epi32(_mm256_sub_epi32(nbml, nbmr)))));
+
+		__m256i no_bk = _mm256_cmpeq_epi32(nbk, zero), no_wk = _mm256_cmpeq_epi32(nwk, zero);
+
+		eval = _mm256_add_epi32(eval, _mm256_and_si256(_mm256_andnot_si256(no_bk, no_wk), king_balance));
+		eval = _mm256_sub_epi32(eval, _mm256_and_si256(_mm256_andnot_si256(no_wk, no_bk), king_balance));
+
+		// back rank, squares 1..4 and 29..32
+		eval = _mm256_add_epi32(eval, _mm256_sub_epi32(
+			_mm256_i32gather_epi32(backrank_black, _mm256_and_si256(men, nibble), 4),
+			_mm256_i32gather_epi32(backrank_white, _mm256_srli_epi32(men, 28), 4)));
+
+		// center control, edges, squares c5, f6, d6
+		for (int k = 0; k < 4; k += 1){
+			eval = _mm256_add_epi32(eval, _mm256_i32gather_epi32(PSQ_BYTES[0][k], _mm256_and_si256(_mm256_srli_epi32(wm, 8*k), bytes), 4));
+			eval = _mm256_add_epi32(eval, _mm256_i32gather_epi32(PSQ_BYTES[1][k], _mm256_and_si256(_mm256_srli_epi32(bm, 8*k), bytes), 4));
 		}
-		else {
-			// add position to big hash table
 
-			index = g->zobristKey % BIG_HASHTABLE_SIZE;
+		// square c5
+		eval = _mm256_add_epi32(eval, _mm256_mullo_epi32(c5,
+			_mm256_and_si256(_mm256_and_si256(_mm256_srli_epi32(wm, 13), _mm256_srli_epi32(empty, 12)), one)));
+		eval = _mm256_sub_epi32(eval, _mm256_mullo_epi32(c5,
+			_mm256_and_si256(_mm256_and_si256(_mm256_srli_epi32(bm, 18), _mm256_srli_epi32(empty, 19)), one)));
+
+		// square e5
+		eval = _mm256_add_epi32(eval, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(bm, 17), one),
+			_mm256_sub_epi32(e5, _mm256_and_si256(opening, e52))));
+		eval = _mm256_add_epi32(eval, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(wm, 14), one),
+			_mm256_sub_epi32(_mm256_and_si256(opening, e52), e5)));
+
+		eval = _mm256_blendv_epi8(eval, _mm256_set1_epi32(-MATE), none);
+
+		_mm256_storeu_si256((__m256i*) (scores + i), eval);
+	}
+}
+#endif
+
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+/**
+ * evaluate_batch_avx2() with 16 positions a pass (n a multiple of 16),
+ *  conditions are lane masks
+ */
+void evaluate_batch_avx512(const struct packed* positions, int n, int* scores){
+	int backrank_black[16], backrank_white[16];
+
+	for (int i = 0; i < 16; i += 1){
+		backrank_black[i] = WEIGHTS.backrank * WEIGHTS.backrank_values[REVERSE4[i]];
+		backrank_white[i] = WEIGHTS.backrank * WEIGHTS.backrank_values[i];
+	}
+
+	const __m512i fields = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60),
+		one = _mm512_set1_epi32(1), zero = _mm512_setzero_si512(),
+		man = _mm512_set1_epi32(WEIGHTS.man), king = _mm512_set1_epi32(WEIGHTS.king),
+		exchange = _mm512_set1_epi32(WEIGHTS.exchange), balance = _mm512_set1_epi32(WEIGHTS.balance),
+		king_balance = _mm512_set1_epi32(WEIGHTS.king_balance),
+		turn = _mm512_set1_epi32(WEIGHTS.turn), turn2 = _mm512_set1_epi32(2*WEIGHTS.turn),
+		c5 = _mm512_set1_epi32(WEIGHTS.c5), e5 = _mm512_set1_epi32(WEIGHTS.e5), e52 = _mm512_set1_epi32(2*WEIGHTS.e5),
+		left = _mm512_set1_epi32(LEFT_SQUARES), right = _mm512_set1_epi32(RIGHT_SQUARES),
+		bytes = _mm512_set1_epi32(255), nibble = _mm512_set1_epi32(15);
+
+	for (int i = 0; i < n; i += 16){
+		const int* p = (const int*) (positions + i);
+
+		__m512i black = _mm512_i32gather_epi32(fields, p, 4),
+			white = _mm512_i32gather_epi32(fields, p + 1, 4),
+			kings = _mm512_i32gather_epi32(fields, p + 2, 4);
 
-			TTable_big[index].eval = eval;
-			TTable_big[index].flag = flag;
-			TTable_big[index].move_from = move_from;
-			TTable_big[index].move_to = move_to;
-			TTable_big[index].depth = depth;
-			TTable_big[index].color = color;
+		__mmask16 white_moves = _mm512_cmpeq_epi32_mask(_mm512_and_si512(_mm512_i32gather_epi32(fields, p + 3, 4), bytes), one);
 
-			TTable_big[index].occupied = true;
-			TTable_big[index].key = g->zobristKey;
-			TTable_big[index].lock = g->zobristKey >> 32;
+		__m512i wm = _mm512_andnot_si512(kings, white), wk = _mm512_and_si512(kings, white),
+			bm = _mm512_andnot_si512(kings, black), bk = _mm512_and_si512(kings, black),
+			men = _mm512_or_si512(wm, bm),
+			empty = _mm512_xor_si512(_mm512_or_si512(black, white), _mm512_set1_epi32(-1));
+
+		__m512i nwml = _mm512_popcnt_epi32(_mm512_and_si512(wm, left)), nwmr = _mm512_popcnt_epi32(_mm512_and_si512(wm, right)),
+			nbml = _mm512_popcnt_epi32(_mm512_and_si512(bm, left)), nbmr = _mm512_popcnt_epi32(_mm512_and_si512(bm, right)),
+			nwk = _mm512_popcnt_epi32(wk), nbk = _mm512_popcnt_epi32(bk),
+			nwm = _mm512_add_epi32(nwml, nwmr), nbm = _mm512_add_epi32(nbml, nbmr);
+
+		__m512i v1 = _mm512_add_epi32(_mm512_mullo_epi32(man, nbm), _mm512_mullo_epi32(king, nbk)),
+			v2 = _mm512_add_epi32(_mm512_mullo_epi32(man, nwm), _mm512_mullo_epi32(king, nwk)),
+			eval = _mm512_sub_epi32(v1, v2);
+
+		__mmask16 none = _mm512_cmpeq_epi32_mask(v1, zero) | _mm512_cmpeq_epi32_mask(v2, zero),
+			opening = _mm512_cmpgt_epi32_mask(_mm512_add_epi32(_mm512_add_epi32(nbm, nbk), _mm512_add_epi32(nwm, nwk)), _mm512_set1_epi32(16));
+
+		// exchanges, (v1+v2 + none) is never 0
+		__m512i num = _mm512_mullo_epi32(exchange, eval),
+			den = _mm512_mask_add_epi32(_mm512_add_epi32(v1, v2), none, _mm512_add_epi32(v1, v2), one);
+
+		__m256i lo = _mm512_cvttpd_epi32(_mm512_div_pd(
+				_mm512_cvtepi32_pd(_mm512_castsi512_si256(num)), _mm512_cvtepi32_pd(_mm512_castsi512_si256(den)))),
+			hi = _mm512_cvttpd_epi32(_mm512_div_pd(
+				_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(num, 1)), _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(den, 1))));
+
+		eval = _mm512_add_epi32(eval, _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1));
+
+		// color to move
+		eval = _mm512_add_epi32(eval, turn);
+		eval = _mm512_mask_sub_epi32(eval, white_moves, eval, turn2);
+
+		// balance, king's balance
+		eval = _mm512_add_epi32(eval, _mm512_mullo_epi32(balance, _mm512_sub_epi32(
+			_mm512_abs_epi32(_mm512_sub_epi32(nwml, nwmr)), _mm512_abs_epi32(_mm512_sub_epi32(nbml, nbmr)))));
+
+		__mmask16 no_bk = _mm512_cmpeq_epi32_mask(nbk, zero), no_wk = _mm512_cmpeq_epi32_mask(nwk, zero);
+
+		eval = _mm512_mask_add_epi32(eval, ~no_bk & no_wk, eval, king_balance);
+		eval = _mm512_mask_sub_epi32(eval, no_bk & ~no_wk, eval, king_balance);
+
+		// back rank, squares 1..4 and 29..32
+		eval = _mm512_add_epi32(eval, _mm512_sub_epi32(
+			_mm512_i32gather_epi32(_mm512_and_si512(men, nibble), backrank_black, 4),
+			_mm512_i32gather_epi32(_mm512_srli_epi32(men, 28), backrank_white, 4)));
+
+		// center control, edges, squares c5, f6, d6
+		for (int k = 0; k < 4; k += 1){
+			eval = _mm512_add_epi32(eval, _mm512_i32gather_epi32(_mm512_and_si512(_mm512_srli_epi32(wm, 8*k), bytes), PSQ_BYTES[0][k], 4));
+			eval = _mm512_add_epi32(eval, _mm512_i32gather_epi32(_mm512_and_si512(_mm512_srli_epi32(bm, 8*k), bytes), PSQ_BYTES[1][k], 4));
 		}
+
+		// square c5
+		eval = _mm512_mask_add_epi32(eval, _mm512_test_epi32_mask(_mm512_and_si512(_mm512_srli_epi32(wm, 13), _mm512_srli_epi32(empty, 12)), one), eval, c5);
+		eval = _mm512_mask_sub_epi32(eval, _mm512_test_epi32_mask(_mm512_and_si512(_mm512_srli_epi32(bm, 18), _mm512_srli_epi32(empty, 19)), one), eval, c5);
+
+		// square e5, -e5 in the opening
+		__mmask16 e5_black = _mm512_test_epi32_mask(_mm512_srli_epi32(bm, 17), one),
+			e5_white = _mm512_test_epi32_mask(_mm512_srli_epi32(wm, 14), one);
+
+		eval = _mm512_mask_add_epi32(eval, e5_black, eval, _mm512_mask_sub_epi32(e5, opening, e5, e52));
+		eval = _mm512_mask_sub_epi32(eval, e5_white, eval, _mm512_mask_sub_epi32(e5, opening, e5, e52));
+
+		eval = _mm512_mask_mov_epi32(eval, none, _mm512_set1_epi32(-MATE));
+
+		_mm512_storeu_si512(scores + i, eval);
 	}
 }
+#endif
 
 
 /**
- * Add a killer move
- *  move primary to secondaray
- *  then add new move to primary
+ * Map a pattern tables file,
+ *  (replaces the loaded one, positions set up before need init_eval_terms())
+ *
+ * returns false if the file cant be read or isnt a tables file
  */
-inline void addkiller(struct info* info, int depth, int from, int to){
-	if (from != info->killer1_from[depth] || to != info->killer1_to[depth]){
-		info->killer2_from[depth] = info->killer1_from[depth];
-		info->killer2_to[depth] = info->killer1_to[depth];
+bool patterns_load(const char* path){
+	size_t size;
+	struct patterns* p = file_map(path, &size);
+
+	if (!p) return false;
 
-		info->killer1_from[depth] = from;
-		info->killer1_to[depth] = to;		
+	if (size < sizeof(struct patterns) || memcmp(p->magic, "KDPT", 4) != 0
+		|| p->windows != PATTERN_WINDOWS || p->states != PATTERN_STATES
+		|| size != sizeof(struct patterns) + PATTERN_WINDOWS * PATTERN_STATES * sizeof(short)
+	){
+		file_unmap(p, size);
+		return false;
 	}
+
+	patterns_free();
+
+	PATTERNS = p;
+	PATTERNS_SIZE = size;
+	PATTERN_TERMS = true;
+	return true;
+}
+
+
+/**
+ * Unmap the pattern tables
+ *  (the search falls back to the handwritten evaluator)
+ */
+void patterns_free(){
+	file_unmap(PATTERNS, PATTERNS_SIZE);
+
+	PATTERNS = NULL;
+	PATTERNS_SIZE = 0;
+	PATTERN_TERMS = false;
 }
 
 
 /**
- * Add history move
+ * Read a weights file into WEIGHTS,
+ *  fields it doesnt set keep their value
+ *
+ * returns false if the file cant be read, has an unknown field or too
+ *  many values, or the weights are baked in (CONST_WEIGHTS)
  */
-inline void addhistory(struct info* info, int depth, int frm, int to, bool limit){
-	int v = info->History[frm][to] + (depth * depth);
+bool weights_load(const char* path){
+#ifdef CONST_WEIGHTS
+	return false;
+#else
+	struct weights w = WEIGHTS;
+	FILE* f = fopen(path, "r");
+
+	char name[32];
+	int *field = NULL, left = 0, c, prev, i;
+	bool ok = true;
+
+	if (!f) return false;
+
+	while (ok && (c = fgetc(f)) != EOF){
+		// comments
+		if (c == '/'){
+			c = fgetc(f);
+
+			if (c == '/')
+				while ((c = fgetc(f)) != EOF && c != '\n');
+			else if (c == '*')
+				for (prev = 0; (c = fgetc(f)) != EOF && !(prev == '*' && c == '/'); prev = c);
+			else
+				ok = false;
+		}
+
+		// .name
+		else if (c == '.'){
+			ok = fscanf(f, "%31[a-z_0-9]", name) == 1;
+
+			for (i = 0; ok && i < WEIGHT_FIELDS_N && strcmp(name, WEIGHT_FIELDS[i].name) != 0; i += 1);
+
+			if (ok && i < WEIGHT_FIELDS_N){
+				field = (int*) ((char*) &w + WEIGHT_FIELDS[i].offset);
+				left = WEIGHT_FIELDS[i].count;
+			} else {
+				ok = false;
+			}
+		}
 
-	if (limit) {
-		if (v > 86475) {
-			for (int i = 0; i < 32; i++)
-				for (int j = 0; j < 32; j++) if (i != j)
-					info->History[frm][to] /= 16.4;
-			v /= 16.4;
+		// its values
+		else if (c == '-' || isdigit(c)){
+			ungetc(c, f);
+
+			if (left && fscanf(f, "%d", field) == 1)
+				field += 1, left -= 1;
+			else
+				ok = false;
+		}
+
+		else if (!isspace(c) && !strchr("{},=", c)){
+			ok = false;
 		}
 	}
 
-	info->History[frm][to] = v;
+	fclose(f);
+
+	if (!ok) return false;
+
+	WEIGHTS = w;
+	weights_changed();
+	return true;
+#endif
 }
 
 
 /**
- * Add counter move
- * 
- * Map the move that got us into this current gamestate
- *  to a new move
+ * Write WEIGHTS as a weights file
+ *  (the format of src/weights.c)
+ *
+ * returns false if the file cant be written
  */
-inline void addcounter(struct info* info, int color, int prev_from, int prev_to, int from, int to){
-	info->counterMoves[(color == -1)][prev_from][prev_to] = C(from, 0, to);
+bool weights_save(const char* path){
+	FILE* f = fopen(path, "w");
+	const int* field;
+
+	if (!f) return false;
+
+	fprintf(f, "\n// Kodra evaluation weights ('set weights <file>', or build with WEIGHTS=<file>)\n\n{\n");
+
+	for (int i = 0; i < WEIGHT_FIELDS_N; i += 1){
+		field = (const int*) ((const char*) &WEIGHTS + WEIGHT_FIELDS[i].offset);
+
+		if (WEIGHT_FIELDS[i].count == 1){
+			fprintf(f, "\t.%s = %d,\n", WEIGHT_FIELDS[i].name, field[0]);
+			continue;
+		}
+
+		// arrays, the board ones in rows of 4
+		fprintf(f, "\t.%s = {", WEIGHT_FIELDS[i].name);
+
+		for (int j = 0; j < WEIGHT_FIELDS[i].count; j += 1){
+			if (WEIGHT_FIELDS[i].count == BOARD_SIZE)
+				fprintf(f, (j % 4) ? " %3d," : "\n\t\t%3d,", field[j]);
+			else
+				fprintf(f, j ? ", %d" : "%d", field[j]);
+		}
+
+		fprintf(f, (WEIGHT_FIELDS[i].count == BOARD_SIZE) ? "\n\t},\n" : "},\n");
+	}
+
+	fprintf(f, "}\n");
+	return fclose(f) == 0;
 }
 
 
 /**
- * Return Heuristic evaluation value of position
+ * Rebuild what is derived from WEIGHTS,
+ *  after they are changed
  */
-int evaluate(Gamestate* game, int color, int depth) {
-	int eval;
-	int v1, v2;
-	int nbm, nbk, nwm, nwk;
-	int nbml, nbkl, nwml, nwkl;  // pieces on left side
-	int nbmr, nbkr, nwmr, nwkr;  // pieces on right side
+void weights_changed(){
+	init_weights();
 
-	int code=0, backrank;
-	static int value[17] = {0,0,0,0,0,1,256,0,0,16,4096,0,0,0,0,0,0};
+	// cached with the old weights
+	memset(STRUCTURE, 0, sizeof(STRUCTURE));
+}
 
-	const int turn = 3;   // color to move gets +turn
-	const int brv = 3;    // multiplier for back rank
 
-	field * b = game->board;
+/**
+ * Pattern evaluation of position,
+ *  same scale and sign as evaluate()
+ */
+int evaluate_patterns(Gamestate* game, int color, int depth){
+	struct patterns* p = PATTERNS;
+	int eval, nwm, nwk, nbm, nbk;
 
-	// count left side pieces
-	code += value[b[3].value];
-	code += value[b[2].value];
-	code += value[b[7].value];
-	code += value[b[6].value];
-	code += value[b[11].value];
-	code += value[b[10].value];
-	code += value[b[15].value];
-	code += value[b[14].value];
-	code += value[b[19].value];
-	code += value[b[18].value];
-	code += value[b[23].value];
-	code += value[b[22].value];
-	code += value[b[27].value];
-	code += value[b[26].value];
-	code += value[b[31].value];
-	code += value[b[30].value];
+	nwm = game->code[0] % 16 + game->code[1] % 16;
+	nwk = (game->code[0] >> 4) % 16 + (game->code[1] >> 4) % 16;
+	nbm = (game->code[0] >> 8) % 16 + (game->code[1] >> 8) % 16;
+	nbk = (game->code[0] >> 12) % 16 + (game->code[1] >> 12) % 16;
 
-	nwml = code % 16;
-	nwkl = (code >> 4) % 16;
-	nbml = (code >> 8) % 16;
-	nbkl = (code >> 12) % 16;
+	if (!(nbm + nbk) || !(nwm + nwk))
+		return -MATE+depth;
 
+	eval = p->king * (nbk - nwk);
+	eval += (color == BLACK) ? p->turn : -p->turn;
 
-	code = 0;
+	for (int w = 0; w < PATTERN_WINDOWS; w += 1)
+		eval += p->weights[w * PATTERN_STATES + game->pattern[w]];
 
-	// count right side pieces
-	code += value[b[1].value];
-	code += value[b[0].value];
-	code += value[b[5].value];
-	code += value[b[4].value];
-	code += value[b[9].value];
-	code += value[b[8].value];
-	code += value[b[13].value];
-	code += value[b[12].value];
-	code += value[b[17].value];
-	code += value[b[16].value];
-	code += value[b[21].value];
-	code += value[b[20].value];
-	code += value[b[25].value];
-	code += value[b[24].value];
-	code += value[b[29].value];
-	code += value[b[28].value];
+	return eval;
+}
 
-	nwmr = code % 16;
-	nwkr = (code >> 4) % 16;
-	nbmr = (code >> 8) % 16;
-	nbkr = (code >> 12) % 16;
 
-	nbm = nbml + nbmr;
-	nbk = nbkl + nbkr;
-	nwm = nwml + nwmr;
-	nwk = nwkl + nwkr;
+/**
+ * Map a network file,
+ *  (replaces the loaded one, positions set up before need init_eval_terms())
+ *
+ * returns false if the file cant be read or isnt a network of our sizes
+ */
+bool nnue_load(const char* path){
+	size_t size;
+	struct network* n = file_map(path, &size);
+	const char* p;
+
+	if (!n) return false;
+
+	if (size != NNUE_FILE_SIZE || memcmp(n->magic, "KDNN", 4) != 0
+		|| n->inputs != NNUE_INPUTS || n->hidden != NNUE_HIDDEN
+		|| n->l1 != NNUE_L1 || n->l2 != NNUE_L2 || n->scale <= 0
+	){
+		file_unmap(n, size);
+		return false;
+	}
 
-	v1 = 200*nbm + 500*nbk;
-	v2 = 200*nwm + 500*nwk;
+	nnue_free();
 
-	if (v1 == 0 || v2 == 0)
-		return -MATE+depth;
+	// layers, in file order
+	p = (const char*) (n + 1);
 
-	eval = v1 - v2;                         /*material values*/
-	eval += (400 * (v1-v2)) / (v1+v2);      /*favor exchanges if in material plus*/
-	eval += (color == BLACK) ? turn : -turn;
-											/* balance                */
-	eval -= abs(nbml - nbmr) * 2;
-	eval += abs(nwml - nwmr) * 2;
+	NNUE_WEIGHTS = (const short*) p;     p += NNUE_INPUTS * NNUE_HIDDEN * sizeof(short);
+	NNUE_BIASES = (const short*) p;      p += NNUE_HIDDEN * sizeof(short);
+	NNUE.l1_weights = (const signed char*) p;  p += NNUE_L1 * 2*NNUE_HIDDEN;
+	NNUE.l1_biases = (const int*) p;           p += NNUE_L1 * sizeof(int);
+	NNUE.l2_weights = (const signed char*) p;  p += NNUE_L2 * NNUE_L1;
+	NNUE.l2_biases = (const int*) p;           p += NNUE_L2 * sizeof(int);
+	NNUE.out_weights = (const signed char*) p; p += NNUE_L2;
+	NNUE.out_bias = (const int*) p;
 
-											/* king's balance         */
-	if ((nbk == 0) && (nwk != 0))
-		eval -= 500;
-	if ((nbk != 0 ) && (nwk == 0))
-		eval += 500;
+	NNUE.file = n;
+	NNUE.size = size;
+	return true;
+}
 
-	code = 0;
-	if(b[3].value & MAN) code += 1;
-	if(b[2].value & MAN) code += 2;
-	if(b[1].value & MAN) code += 4; // Golden checker
-	if(b[0].value & MAN) code += 8;
 
-	switch (code) {
-		case 0: code=0;break;
-		case 1: code=-1;break;
-		case 2: code=1;break;
-		case 3: code=0;break;
-		case 4: code=3;break;
-		case 5: code=3;break;
-		case 6: code=3;break;
-		case 7: code=3;break;
-		case 8: code=1;break;
-		case 9: code=1;break;
-		case 10: code=2;break;
-		case 11: code=2;break;
-		case 12: code=4;break;
-		case 13: code=4;break;
-		case 14: code=9;break;
-		case 15: code=8;break;
-	}
-	backrank = code;
+/**
+ * Unmap the network
+ *  (domove()/undomove() stop keeping the accumulators)
+ */
+void nnue_free(){
+	file_unmap(NNUE.file, NNUE.size);
 
-	code=0;
-	if(b[31].value & MAN) code += 8;
-	if(b[30].value & MAN) code += 4; // Golden checker
-	if(b[29].value & MAN) code += 2;
-	if(b[28].value & MAN) code += 1;
+	NNUE_WEIGHTS = NNUE_BIASES = NULL;
+	NNUE = (struct nnue) {NULL};
+}
 
-	switch (code) {
-		case 0: code=0;break;
-		case 1: code=-1;break;
-		case 2: code=1;break;
-		case 3: code=0;break;
-		case 4: code=3;break;
-		case 5: code=3;break;
-		case 6: code=3;break;
-		case 7: code=3;break;
-		case 8: code=1;break;
-		case 9: code=1;break;
-		case 10: code=2;break;
-		case 11: code=2;break;
-		case 12: code=4;break;
-		case 13: code=4;break;
-		case 14: code=9;break;
-		case 15: code=8;break;
-	}
-	backrank -= code;
-	eval += brv * backrank;
-
-	/* center control */
-	if(b[22].value == (WHITE|MAN)) eval -= 2;
-	if(b[21].value == (WHITE|MAN)) eval -= 2;
-	if(b[18].value == (WHITE|MAN)) eval -= 2;
-	if(b[17].value == (WHITE|MAN)) eval -= 2;
-
-	if(b[10].value == (BLACK|MAN)) eval += 2;
-	if(b[9].value == (BLACK|MAN)) eval += 2;
-	if(b[14].value == (BLACK|MAN)) eval += 2;
-	if(b[13].value == (BLACK|MAN)) eval += 2;
-
-	/*  edge         */
-	// BLACK
-	if ((b[4].value & BLACK))
-		if ((b[4].value & MAN)) eval -= 2;
-	if ((b[11].value & BLACK))
-		if ((b[11].value & MAN)) eval -= 2;
-
-	if ((b[12].value & BLACK))
-		if ((b[12].value & MAN)) eval -= 2;
-
-	if ((b[19].value & BLACK))
-		if ((b[19].value & MAN)) eval -= 2;
-
-	if ((b[20].value & BLACK))
-		if ((b[20].value & MAN)) eval -= 2;
-
-	if ((b[27].value & BLACK))
-		if ((b[27].value & MAN)) eval -= 2;
-
-	// WHITE
-	if ((b[4].value & WHITE))
-		if ((b[4].value & MAN)) eval += 2;
-
-	if ((b[11].value & WHITE))
-		if ((b[11].value & MAN)) eval += 2;
-
-	if ((b[12].value & WHITE))
-		if ((b[12].value & MAN)) eval += 2;
-
-	if ((b[19].value & WHITE))
-		if ((b[19].value & MAN)) eval += 2;
-
-	if ((b[20].value & WHITE))
-		if ((b[20].value & MAN)) eval += 2;
-
-	if ((b[27].value & WHITE))
-		if ((b[27].value & MAN)) eval += 2;
 
-	// square c5
-	if (b[13].value == (WHITE|MAN)) {
-		eval -= 9;
-		if (b[12].value == FREE) eval += 5;
+/**
+ * Network input, both accumulators clipped
+ *  to 0..127, side to move (`us`) first
+ */
+void nnue_transform_scalar(const short* us, const short* them, unsigned char* out){
+	for (int i = 0; i < NNUE_HIDDEN; i += 1){
+		out[i] = min(max(us[i], 0), 127);
+		out[NNUE_HIDDEN + i] = min(max(them[i], 0), 127);
 	}
+}
+
+
+/**
+ * Dense layer, `m` outputs of `n` inputs (n a multiple of 32),
+ *  out[j] = biases[j] + sum(weights[j][i] * in[i])
+ */
+void nnue_layer_scalar(const unsigned char* in, int n, const signed char* weights, const int* biases, int m, int* out){
+	for (int j = 0; j < m; j += 1){
+		int sum = biases[j];
+
+		for (int i = 0; i < n; i += 1)
+			sum += weights[j*n + i] * in[i];
 
-	if (b[18].value == (BLACK|MAN)) {
-		eval += 9;
-		if (b[19].value == FREE) eval -= 5;
+		out[j] = sum;
 	}
+}
 
-	// square f6
-	if (b[10].value == (WHITE|MAN))
-		eval -= 7;
-	
-	if (b[21].value == (BLACK|MAN))
-		eval +=7;
-	
-	// square e5
-	if (b[17].value == (BLACK|MAN)) {
-		if (nbm+nbk+nwm+nwk > 16) eval -= 3;
-		else eval += 3;
+
+#ifdef __AVX2__
+/**
+ * nnue_transform_scalar(), 32 values at a time
+ */
+void nnue_transform_avx2(const short* us, const short* them, unsigned char* out){
+	const short* acc[2] = {us, them};
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (int s = 0; s < 2; s += 1){
+		for (int i = 0; i < NNUE_HIDDEN; i += 32){
+			__m256i a = _mm256_loadu_si256((__m256i*) (acc[s] + i)),
+				b = _mm256_loadu_si256((__m256i*) (acc[s] + i + 16));
+
+			// saturate to -128..127 (packs mixes the 128 bit lanes, permute puts them back)
+			__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+
+			_mm256_storeu_si256((__m256i*) (out + s*NNUE_HIDDEN + i), _mm256_max_epi8(v, zero));
+		}
 	}
+}
 
-	if (b[14].value == (WHITE|MAN)) {
-		if (nbm+nbk+nwm+nwk > 16) eval += 3;
-		else eval -= 3;
+
+/**
+ * nnue_layer_scalar(), u8 x i8 products summed in pairs to
+ *  16 bits (no overflow, inputs are <= 127) then to 32 bits
+ */
+void nnue_layer_avx2(const unsigned char* in, int n, const signed char* weights, const int* biases, int m, int* out){
+	const __m256i ones = _mm256_set1_epi16(1);
+
+	for (int j = 0; j < m; j += 1){
+		__m256i sum = _mm256_setzero_si256();
+
+		for (int i = 0; i < n; i += 32){
+			__m256i x = _mm256_loadu_si256((__m256i*) (in + i)),
+				w = _mm256_loadu_si256((__m256i*) (weights + j*n + i));
+
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+		}
+
+		// horizontal sum
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+
+		out[j] = biases[j] + _mm_cvtsi128_si32(s);
 	}
+}
+#endif
 
-	// square d6
-	if (b[9].value == (WHITE|MAN))
-		eval -= 7;
 
-	if (b[22].value == (BLACK|MAN))
-		eval +=7;
+/**
+ * Network evaluation of position,
+ *  same scale and sign as evaluate()
+ */
+int evaluate_nnue(Gamestate* game, int color, int depth){
+	unsigned char input[2*NNUE_HIDDEN], hidden1[NNUE_L1], hidden2[NNUE_L2];
+	int sums[NNUE_L1], side = (color == BLACK) ? 0 : 1, out,
+		code = game->code[0] + game->code[1];   // (4 bit counts, cant carry)
 
-	return eval;
+	// a side without pieces
+	if (!(code & 0xFF) || !(code >> 8))
+		return -MATE+depth;
+
+	nnue_transform(game->accumulator[side], game->accumulator[!side], input);
+
+	nnue_layer(input, 2*NNUE_HIDDEN, NNUE.l1_weights, NNUE.l1_biases, NNUE_L1, sums);
+
+	for (int i = 0; i < NNUE_L1; i += 1)
+		hidden1[i] = min(max(sums[i] >> NNUE_SHIFT, 0), 127);
+
+	nnue_layer(hidden1, NNUE_L1, NNUE.l2_weights, NNUE.l2_biases, NNUE_L2, sums);
+
+	for (int i = 0; i < NNUE_L2; i += 1)
+		hidden2[i] = min(max(sums[i] >> NNUE_SHIFT, 0), 127);
+
+	nnue_layer(hidden2, NNUE_L2, NNUE.out_weights, NNUE.out_bias, 1, &out);
+
+	out /= NNUE.file->scale;
+
+	return side ? -out : out;
 }
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>    // (before the log() macro below)
 
 #include "move.c"
 
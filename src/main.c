@@ -19,6 +19,63 @@
 int WINAPI getmove (int b[8][8], int color, double time, char str[1024], int *playnow, int info, int unused, struct CBmove *move);
 int WINAPI enginecommand (char command[256], char reply[1024]);
 int WINAPI islegal (int b[8][8], int color, int from, int to, struct  CBmove *move);
+int WINAPI opponentmove (int from, int to);
+
+
+// search context, see search_start()
+struct searchctx;
+
+typedef void (WINAPI *search_callback)(struct searchctx*, struct CBmove*, struct searchinfo*);
+
+struct searchctx {
+	struct search search;
+	search_callback callback;   // called from the search thread when the search returns
+
+	unsigned int deep_size, big_size;   // TTable sizes
+
+	struct searchctx* next;             // in the list of contexts
+};
+
+struct searchctx* WINAPI search_create ();
+void WINAPI search_destroy (struct searchctx* ctx);
+int WINAPI search_start (struct searchctx* ctx, int b[8][8], int color, struct limits* limits, search_callback callback);
+int WINAPI search_pin (struct searchctx* ctx, int cpu);
+int WINAPI search_poll (struct searchctx* ctx, struct searchinfo* info);
+int WINAPI search_stop (struct searchctx* ctx);
+
+void free_tables ();
+void stop_searches ();
+void search_done (struct search* s);
+
+
+// TTables, kept between moves
+struct TEntry* _TTable_deep = NULL;
+struct TEntry* _TTable_big = NULL;
+
+// search contexts, see stop_searches()
+struct searchctx* _contexts = NULL;
+lock_t _contexts_lock;
+
+
+// search tuning, 'get/set <name> <n>'
+struct option {
+	char* name;
+	int* value;
+	int min, max;
+} options[] = {
+	{"lmrdepth", &LMR_DEPTH, 2, MAXDEPTH},
+	{"lmrmoves", &LMR_MOVES, 1, MAXMOVES},
+	{"lmrbase", &LMR_BASE, 0, 1000},
+	{"lmrdiv", &LMR_DIV, 1, 100000},
+	{"lmrhistory", &LMR_HISTORY, 1, INT_MAX},
+	{"lmpdepth", &LMP_DEPTH, 0, MAXDEPTH},
+	{"lmpmoves", &LMP_MOVES, 1, MAXMOVES},
+	{"lmphistory", &LMP_HISTORY, -3*HISTORY_MAX, 3*HISTORY_MAX+1},
+	{"sedepth", &SE_DEPTH, 0, MAXDEPTH},
+	{"semargin", &SE_MARGIN, 0, 1000},
+};
+
+#define OPTIONS (sizeof(options) / sizeof(struct option))
 
 
 /* dll entry point */
@@ -32,6 +89,15 @@ DllEntryPoint (HANDLE hDLL, DWORD dwReason, LPVOID lpReserved){
 		case DLL_PROCESS_ATTACH:
 			break;
 		case DLL_PROCESS_DETACH:
+			// no threads can be joined under the loader lock, hosts stop the
+			//  searches first with enginecommand("stop"), at process exit
+			//  (lpReserved set) the threads are gone and nothing needs freeing
+			if (!lpReserved){
+				tables_free(_TTable_deep, _TTable_big);
+				patterns_free();
+				nnue_free();
+				evalcache_free();
+			}
 			break;
 		case DLL_THREAD_ATTACH:
 			break;
@@ -52,8 +118,12 @@ DllEntryPoint (HANDLE hDLL, DWORD dwReason, LPVOID lpReserved){
  * - CheckerBoard API
  */
 int WINAPI getmove(int b[8][8], int color, double time, char str[1024], int *playnow, int info, int unused, struct CBmove *cbmove) {
-	int res;
+	int res = UNKNOWN;
 	Gamestate* game =  &(Gamestate){};
+	struct timer timer;
+	affinity_t affinity;
+	bool pinned = false;
+	Move best;
 
 	// convert board
 	arrayboard_to_squareboard(b, game->board);
@@ -63,35 +133,47 @@ int WINAPI getmove(int b[8][8], int color, double time, char str[1024], int *pla
 
 	game->prev_from=0, game->prev_to=0;
 
-	// initialize TTableflags
-	struct TEntry* TTable_deep = calloc(DEEP_HASHTABLE_SIZE, sizeof(struct TEntry));
-	struct TEntry* TTable_big = calloc(BIG_HASHTABLE_SIZE, sizeof(struct TEntry));
-
-	//////////////////
-	// reset tables //
-	//////////////////
-
-	// history table
-	for (int i = 0; i < 32; i++){
-		for (int j = 0; j < 32; j++){
-			_info.History[i][j] = 0;
-		}
+	// search on core `CPU` (the caller's cpus are restored after)
+	if (CPU >= 0){
+		pinned = thread_pin(CPU, &affinity);
 	}
 
-	// killer table
-	for (int i = 0; i < MAXDEPTH; i+=1){
-		_info.killer2_to[i] = 0,
-		_info.killer1_to[i] = 0,
-		_info.killer1_from[i] = 0,
-		_info.killer2_from[i] = 0;
+	// initialize TTables
+	if (!_TTable_deep){
+		tables_alloc(&_TTable_deep, &_TTable_big, CPU);
 	}
 
+	// opponent played the move we pondered on ?
+	if (!ponder_finish(&_ponder, game, time, playnow, &best, &res, str)){
+
+		//////////////////
+		// reset tables //
+		//////////////////
+
+		// history tables
+		memset(_info.History, 0, sizeof(_info.History));
+		memset(_info.ContHistory, 0, sizeof(_info.ContHistory));
+
+		// killers, search stack
+		memset(_info.stack, 0, sizeof(_info.stack));
 
-	// get best move
-	Move best = getbestmove(game, color, time, str, TTable_deep, TTable_big, &_info, playnow, &res);
+		// statistics
+		_info.cache_probes = _info.cache_hits = 0;
 
-	free(TTable_deep);
-	free(TTable_big);
+
+		// get best move
+		timer_start(&timer, time, playnow);
+		best = getbestmove(game, color, str, _TTable_deep, _TTable_big, &_info, &timer, &res, NULL);
+	}
+
+	// think on the opponent's time
+	if (PONDER){
+		ponder_start(&_ponder, game, &best, color, _TTable_deep, _TTable_big, &_info);
+	}
+
+	if (pinned){
+		thread_unpin(&affinity);
+	}
 
 	// convert move
 	kodraMoveToCBMove(game->board, &best, cbmove);
@@ -106,6 +188,11 @@ int WINAPI getmove(int b[8][8], int color, double time, char str[1024], int *pla
 
   answers CheckerBoard commands
 
+  'set' commands change what searches read (TTable sizes, evaluator, tables,
+  options), so each one first stops pondering and every running search context
+  (see stop_searches()). It must not be called while another thread is in
+  getmove() or search_start(), searches started afterwards use the new settings.
+
   - CheckerBoard API
  */
 int WINAPI enginecommand (char str[256], char reply[1024]) {
@@ -126,6 +213,12 @@ int WINAPI enginecommand (char str[256], char reply[1024]) {
 		return 1;
 	}
 
+	// stop pondering and every search, before the host unloads the engine
+	if (strcmp (command, "stop") == 0) {
+		stop_searches();
+		return 1;
+	}
+
 	if (strcmp (command, "get") == 0) {
 
 		if (strcmp (param1, "protocolversion") == 0) {
@@ -146,16 +239,78 @@ int WINAPI enginecommand (char str[256], char reply[1024]) {
 			sprintf (reply, "Deep TT size => %dmb\n\nBig TT size => %dmb", DEEP_HASHTABLE_SIZE/ts, BIG_HASHTABLE_SIZE/ts);
 			return 1;
 		} 
+
+		if (strcmp (param1, "multipv") == 0) {
+			sprintf (reply, "%d", MULTIPV);
+			return 1;
+		}
+
+		if (strcmp (param1, "threads") == 0) {
+			sprintf (reply, "%d", THREADS);
+			return 1;
+		}
+
+		if (strcmp (param1, "ponder") == 0) {
+			sprintf (reply, PONDER ? "on" : "off");
+			return 1;
+		}
+
+		if (strcmp (param1, "cpu") == 0) {
+			sprintf (reply, "%d", CPU);
+			return 1;
+		}
+
+		if (strcmp (param1, "numa") == 0) {
+			sprintf (reply, NUMA ? "on (node %d)" : "off", cpu_node(CPU));
+			return 1;
+		}
+
+		if (strcmp (param1, "etcdepth") == 0) {
+			sprintf (reply, "%d", ETC_DEPTH);
+			return 1;
+		}
+
+		if (strcmp (param1, "probcut") == 0) {
+			sprintf (reply, "%d", PROBCUT_DEPTH);
+			return 1;
+		}
+
+		if (strcmp (param1, "evalcache") == 0) {
+			// (of the last move's search)
+			sprintf (reply, "%dkb, %lu/%lu hits (%.1f%%)", EVALCACHE_KB, _info.cache_hits, _info.cache_probes,
+				_info.cache_probes ? 100.0 * _info.cache_hits / _info.cache_probes : 0.0
+			);
+			return 1;
+		}
+
+		if (strcmp (param1, "eval") == 0) {
+			sprintf (reply, (EVAL == EVAL_PATTERNS && PATTERNS) ? "patterns"
+				: (EVAL == EVAL_NNUE && NNUE.file) ? "nnue"
+				: (EVAL == EVAL_BITBOARD) ? "bitboard" : "handwritten");
+			return 1;
+		}
+
+		for (int i = 0; i < OPTIONS; i += 1){
+			if (strcmp (param1, options[i].name) == 0) {
+				sprintf (reply, "%d", *options[i].value);
+				return 1;
+			}
+		}
 	}
 
 	if (strcmp (command, "set") == 0) {
 
+		stop_searches();
+
 		if (strcmp (param1, "hashsize") == 0) {
 			mb = strtol(param2, &e_str, 10) - 2;
 			if (mb < 1) return 0;
 
 			mb = min(mb, 128);
 
+			// reallocated on the next move
+			free_tables();
+
 			BIG_HASHTABLE_SIZE = mb * ts;
 
 			DEEP_HASHTABLE_SIZE = 0.4 * BIG_HASHTABLE_SIZE;
@@ -166,6 +321,130 @@ int WINAPI enginecommand (char str[256], char reply[1024]) {
 			
 			return 1;
 		}
+
+		if (strcmp (param1, "multipv") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (mb < 1) return 0;
+
+			MULTIPV = min(mb, MAXMOVES);
+			return 1;
+		}
+
+		if (strcmp (param1, "threads") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (mb < 1) return 0;
+
+			THREADS = min(mb, 64);
+			return 1;
+		}
+
+		if (strcmp (param1, "ponder") == 0) {
+			PONDER = (strcmp (param2, "on") == 0 || strcmp (param2, "1") == 0);
+			return 1;
+		}
+
+		if (strcmp (param1, "cpu") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (e_str == param2) return 0;
+
+			CPU = (mb < 0) ? -1 : mb;
+
+			// reallocated on the next move (NUMA node)
+			free_tables();
+			return 1;
+		}
+
+		if (strcmp (param1, "numa") == 0) {
+			NUMA = (strcmp (param2, "on") == 0 || strcmp (param2, "1") == 0);
+
+			free_tables();
+			return 1;
+		}
+
+		if (strcmp (param1, "etcdepth") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (e_str == param2 || mb < 0) return 0;
+
+			ETC_DEPTH = (mb == 0) ? 0 : max(mb, HASH_MIN_DEPTH+1);
+			return 1;
+		}
+
+		if (strcmp (param1, "probcut") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (e_str == param2 || mb < 0) return 0;
+
+			PROBCUT_DEPTH = (mb == 0) ? 0 : max(mb, PROBCUT_REDUCTION+1);
+			return 1;
+		}
+
+		// eval cache size in kb (0 => off)
+		if (strcmp (param1, "evalcache") == 0) {
+			mb = strtol(param2, &e_str, 10);
+			if (e_str == param2 || mb < 0) return 0;
+
+			EVALCACHE_KB = min(mb, 1024*1024);
+
+			// (no search is running)
+			evalcache_alloc();
+			return 1;
+		}
+
+		// evaluator, 'handwritten', 'bitboard' (same scores, branch free), 'patterns'
+		//  (needs a tables file) or 'nnue' (needs a network file)
+		if (strcmp (param1, "eval") == 0) {
+			if (strcmp (param2, "handwritten") == 0) EVAL = EVAL_HANDWRITTEN;
+			else if (strcmp (param2, "bitboard") == 0) EVAL = EVAL_BITBOARD;
+			else if (strcmp (param2, "patterns") == 0 && PATTERNS) EVAL = EVAL_PATTERNS;
+			else if (strcmp (param2, "nnue") == 0 && NNUE.file) EVAL = EVAL_NNUE;
+			else return 0;
+
+			evalcache_clear();
+
+			return 1;
+		}
+
+		// pattern tables file, the search switches to them
+		//  (the old tables are unmapped, no search is running)
+		if (strcmp (param1, "patterns") == 0) {
+			if (!patterns_load(param2)) return 0;
+
+			EVAL = EVAL_PATTERNS;
+			evalcache_clear();
+			return 1;
+		}
+
+		// handwritten evaluator weights file (see src/weights.c),
+		//  not with the weights baked in (no search is running)
+		if (strcmp (param1, "weights") == 0) {
+			if (!weights_load(param2)) return 0;
+
+			evalcache_clear();
+			return 1;
+		}
+
+		// network file, the search switches to it
+		//  (the old one is unmapped, no search is running; each search
+		//   sets its position up again, with the new accumulators)
+		if (strcmp (param1, "evalfile") == 0) {
+			if (!nnue_load(param2)) return 0;
+
+			EVAL = EVAL_NNUE;
+			evalcache_clear();
+			return 1;
+		}
+
+		for (int i = 0; i < OPTIONS; i += 1){
+			if (strcmp (param1, options[i].name) == 0) {
+				mb = strtol(param2, &e_str, 10);
+				if (e_str == param2 || mb < options[i].min || mb > options[i].max) return 0;
+
+				*options[i].value = mb;
+
+				// (no search is running)
+				lmr_init();
+				return 1;
+			}
+		}
 	}
 
 	strcpy (reply, "?");
@@ -223,3 +502,227 @@ int WINAPI islegal (int b[8][8], int color, int from, int to, struct  CBmove *mo
 	return false;
 }
 
+
+/*
+ int opponentmove()
+
+  The move the opponent played (squares 1-32), call before the next getmove(),
+  returns 1 if it was the move we pondered on, else the ponder search is dropped
+
+  - Kodra API
+ */
+int WINAPI opponentmove (int from, int to) {
+	return ponder_reply(&_ponder, from, to);
+}
+
+
+/*
+ void free_tables()
+
+  Stop pondering and free the TTables
+ */
+void free_tables () {
+	ponder_stop(&_ponder);
+
+	tables_free(_TTable_deep, _TTable_big);
+
+	_TTable_deep = _TTable_big = NULL;
+}
+
+
+/*
+ void stop_searches()
+
+  Stop pondering and the searches of all contexts, and wait for them,
+  (before settings they read change)
+ */
+void stop_searches () {
+	ponder_stop(&_ponder);
+
+	lock_acquire(&_contexts_lock);
+		for (struct searchctx* ctx = _contexts; ctx; ctx = ctx->next)
+			search_abort(&ctx->search);
+	lock_release(&_contexts_lock);
+}
+
+
+/*
+ struct searchctx* search_create()
+
+  Create a search context with its own TTables,
+  (one per game, contexts can search at the same time)
+
+  - Kodra API
+ */
+struct searchctx* WINAPI search_create () {
+	struct searchctx* ctx = calloc(1, sizeof(struct searchctx));
+
+	if (!ctx) return NULL;
+
+	ctx->search.cpu = CPU;
+	ctx->search.done = search_done;
+	ctx->search.data = ctx;
+
+	if (!tables_alloc(&ctx->search.TTable_deep, &ctx->search.TTable_big, ctx->search.cpu)){
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->deep_size = DEEP_HASHTABLE_SIZE;
+	ctx->big_size = BIG_HASHTABLE_SIZE;
+
+	lock_acquire(&_contexts_lock);
+		ctx->next = _contexts;
+		_contexts = ctx;
+	lock_release(&_contexts_lock);
+
+	return ctx;
+}
+
+
+/*
+ void search_destroy()
+
+  Stop the search (if any) and free the context
+
+  - Kodra API
+ */
+void WINAPI search_destroy (struct searchctx* ctx) {
+	lock_acquire(&_contexts_lock);
+		for (struct searchctx** c = &_contexts; *c; c = &(*c)->next){
+			if (*c == ctx){
+				*c = ctx->next;
+				break;
+			}
+		}
+	lock_release(&_contexts_lock);
+
+	search_abort(&ctx->search);
+
+	tables_free(ctx->search.TTable_deep, ctx->search.TTable_big);
+	free(ctx);
+}
+
+
+/*
+ int search_start()
+
+  Start searching position b[][] for `color` in the background,
+  returns at once, `callback` (may be NULL) gets the best move when the search returns.
+  A search already running on `ctx` is stopped first.
+
+  `callback` runs on the search thread, it must not call search_start()/search_stop()/search_destroy()
+  or enginecommand('set ...')
+
+  returns 0 if there's no legal move or the search couldnt be started
+
+  - Kodra API
+ */
+int WINAPI search_start (struct searchctx* ctx, int b[8][8], int color, struct limits* limits, search_callback callback) {
+	struct search* s = &ctx->search;
+	Movelist moves;
+
+	search_abort(s);
+
+	// hashsize changed since the tables were made
+	if (ctx->deep_size != DEEP_HASHTABLE_SIZE || ctx->big_size != BIG_HASHTABLE_SIZE){
+		tables_free(s->TTable_deep, s->TTable_big);
+
+		if (!tables_alloc(&s->TTable_deep, &s->TTable_big, s->cpu)) return 0;
+
+		ctx->deep_size = DEEP_HASHTABLE_SIZE;
+		ctx->big_size = BIG_HASHTABLE_SIZE;
+	}
+
+	s->game = (Gamestate){};
+	arrayboard_to_squareboard(b, s->game.board);
+	init_board_hash(&s->game);
+
+	generate_all_moves(&s->game, color == WHITE, &moves);
+	if (!moves.length) return 0;
+
+	s->color = color;
+	s->info = (struct info){};
+	ctx->callback = callback;
+
+	timer_start(&s->timer, (limits && limits->time > 0) ? limits->time : NO_TIME_LIMIT, &s->play);
+
+	if (limits && limits->depth > 0)
+		s->timer.maxdepth = min(limits->depth, MAXDEPTH-1);
+
+	return search_begin(s);
+}
+
+
+/*
+ int search_pin()
+
+  Pin the context's search thread to core `cpu` (-1 => not pinned),
+  with `set numa on` its TTables are moved to that core's NUMA node
+
+  - Kodra API
+ */
+int WINAPI search_pin (struct searchctx* ctx, int cpu) {
+	struct search* s = &ctx->search;
+
+	search_abort(s);
+
+	s->cpu = (cpu < 0) ? -1 : cpu;
+
+	if (NUMA){
+		tables_free(s->TTable_deep, s->TTable_big);
+		if (!tables_alloc(&s->TTable_deep, &s->TTable_big, s->cpu)) return 0;
+
+		ctx->deep_size = DEEP_HASHTABLE_SIZE;
+		ctx->big_size = BIG_HASHTABLE_SIZE;
+	}
+
+	return 1;
+}
+
+
+/*
+ int search_poll()
+
+  Get the live depth, score and best line of the search,
+  returns 1 while the search is running
+
+  - Kodra API
+ */
+int WINAPI search_poll (struct searchctx* ctx, struct searchinfo* info) {
+	search_status(&ctx->search, info);
+	return info->running;
+}
+
+
+/*
+ int search_stop()
+
+  Stop the search and wait for it to return,
+  (the time that took is reported as `stop_latency` by search_poll())
+
+  - Kodra API
+ */
+int WINAPI search_stop (struct searchctx* ctx) {
+	search_abort(&ctx->search);
+	return 1;
+}
+
+
+/*
+ void search_done()
+
+  Search thread returned, pass the best move to the context's callback
+ */
+void search_done (struct search* s) {
+	struct searchctx* ctx = s->data;
+	struct searchinfo info;
+	struct CBmove move = {0};
+
+	if (!ctx->callback) return;
+
+	search_status(s, &info);
+	kodraMoveToCBMove(s->game.board, &s->best, &move);
+
+	ctx->callback(ctx, &move, &info);
+}
@@ -15,6 +15,12 @@
 #include <time.h>
 #include <string.h>
 
+#ifdef __AVX2__
+	#include <immintrin.h>
+#endif
+
+#include "sys.c"
+
 
 #define WHITE 1
 #define BLACK 2
@@ -32,6 +38,15 @@
 
 #define BOARD_SIZE 32
 
+// pattern evaluation windows, see init_patterns()
+#define PATTERN_WINDOWS 9
+#define PATTERN_SQUARES 8
+#define PATTERN_STATES 6561   // 3^8
+
+// neural network first layer, see NNUE_FEATURE
+#define NNUE_INPUTS 128       // 4 piece kinds x 32 squares
+#define NNUE_HIDDEN 128
+
 typedef char Byte;
 typedef unsigned long long u64;
 
@@ -62,6 +77,14 @@ typedef struct Gamestate {
 	u64 zobristKey;                 // zobrist key of the board
 
 	short prev_from, prev_to;			// the move that got us to the current gamestate
+
+	// evaluation terms, kept up to date by domove()/undomove()
+	int code[2];                    // packed piece counts of the left/right half (see PIECE_CODE)
+	int psq;                        // piece-square sum of the men (+ => good for black)
+	u64 menKey;                     // zobrist key of the men only
+	unsigned int bitboard[4];       // squares (bit 0 => square 1) of each piece, see BITBOARD_INDEX
+	short pattern[PATTERN_WINDOWS]; // index of each pattern window
+	short accumulator[2][NNUE_HIDDEN]; // network first layer seen by black/white (0 => no network)
 } Gamestate;
 
 
@@ -104,6 +127,19 @@ typedef struct Movelist {
 } Movelist;
 
 
+/////////////////////
+// Packed position //
+/////////////////////
+
+// a position in 16 bytes, for datasets and batches of positions
+struct packed {
+	unsigned int black, white, kings;   // squares (bit 0 => square 1)
+	unsigned char turn;                 // 0 => black to move, 1 => white
+	signed char result;                 // (datasets) result of the game for black: 1, 0, -1
+	short unused;
+};
+
+
 ///////////////
 // Shortcuts //
 ///////////////
@@ -122,7 +158,7 @@ typedef struct Movelist {
 u64 rand64();
 
 bool is_prime(long);
-short make_prime(short);
+long make_prime(long);
 
 void domove(Gamestate *, Move*);
 void undomove(Gamestate *, Move*);
@@ -136,8 +172,17 @@ void get_capture(field[BOARD_SIZE], short color, short who, one_capt*, short jum
 bool can_capture(field board[BOARD_SIZE], short color, short from, short piece, short to);
 
 void init_board_hash(Gamestate *);
+void init_zobrist();
+void pack_position(Gamestate *, struct packed *);
+void unpack_position(const struct packed *, Gamestate *);
+void init_eval_terms(Gamestate *);
+void init_eval_tables();
+void init_patterns();
+void init_weights();
+void nnue_update(short*, const short*, int);
 void sort_moves(Move*, short*, short, short);
 void updatehashkey(Gamestate* game);
+u64 movehashkey(Gamestate* game, Move*);
 short idx(short);
 
 void quick_sort(Move array[], int sortVals[], int first_index, int last_index);
@@ -148,6 +193,8 @@ void quick_sort(Move array[], int sortVals[], int first_index, int last_index);
 
 u64 zobristNumbers[32][17];
 
+once_t ZOBRIST_ONCE;   // zobrist numbers created (searches on other threads may hash at the same time)
+
 
 /*
 =====================
@@ -298,25 +345,35 @@ Byte MAN_CAPTURES[BOARD_SIZE][4][2] = {
 
 
 /*
- Generates a hash for the board position.
+ Generates a hash for the board position,
+  (and its evaluation terms)
 
-  This function is called only once
+  The zobrist numbers are only created once, so keys
+  (and the TTables) stay valid between moves
  */
 void init_board_hash(Gamestate* game){
+	run_once(&ZOBRIST_ONCE, init_zobrist);
+
+	updatehashkey(game);
+	init_eval_terms(game);
+}
+
+
+/*
+ Create the hash function (zobrist numbers),
+  reseeds rand()
+ */
+void init_zobrist(){
 	srand(time(NULL));
 
-	// create hash function
-	for (short i = 0; i <= BOARD_SIZE; i += 1) {
+	for (short i = 0; i < BOARD_SIZE; i += 1) {
 		for (short j = 0; j <= 16; j+=1) {
 			zobristNumbers[i][j] = rand64();
 		}
 	}
-
-	updatehashkey(game);
 }
 
 
-
 /**
  * Calculate new hash key for board position
  */
@@ -373,6 +430,291 @@ inline void updatehashkey(Gamestate* game){
 }
 
 
+//////////////////////
+// Evaluation terms //
+//////////////////////
+
+// piece counts packed 4 bits each,
+//  white men | white kings << 4 | black men << 8 | black kings << 12
+const int PIECE_CODE[17] = {0,0,0,0,0,1,256,0,0,16,4096,0,0,0,0,0,0};
+
+// board half of a square, 0 => left (a, c, e, g files side), 1 => right
+#define HALF(sq) (((sq) & 2) ? 0 : 1)
+
+// evaluation weights, + => good for black (see evaluate())
+struct weights {
+	int man, king;
+	int exchange;
+	int turn;
+	int balance;
+	int king_balance;
+	int backrank;
+	int backrank_values[16];   // by men on (bit 0: the square next to the corner .. bit 3: the corner)
+	int psq[BOARD_SIZE];       // black men, white's are mirrored
+	int c5, e5;
+};
+
+// the weights, a weight set file included as the initializer,
+//  CONST_WEIGHTS bakes it in (constant folded, 'set weights' is off)
+#ifndef WEIGHTS_FILE
+	#define WEIGHTS_FILE "weights.c"
+#endif
+
+#ifdef CONST_WEIGHTS
+	static const
+#endif
+struct weights WEIGHTS =
+	#include WEIGHTS_FILE
+;
+
+// men piece-square values (center, edges, key squares), from WEIGHTS.psq
+int PSQ[17][BOARD_SIZE];
+
+// the most the terms after material and kings can add to evaluate() (see init_weights())
+int POSITIONAL_MAX;
+
+// pattern windows, 4x4 squares every 2 rows/columns (8 dark squares each),
+//  their men give a base 3 index (empty 0, white man 1, black man 2, kings count as empty)
+short WINDOW_SQUARES[PATTERN_WINDOWS][PATTERN_SQUARES];
+short PATTERN_INDEX[BOARD_SIZE][PATTERN_WINDOWS];    // what a white man on the square adds (x2 black)
+const short PATTERN_STATE[17] = {[WHITE|MAN] = 1, [BLACK|MAN] = 2};
+
+// pattern tables loaded (see patterns_load()), false => the window indices arent kept
+bool PATTERN_TERMS = false;
+
+once_t EVAL_TABLES_ONCE;   // pattern windows and weight tables filled, see init_eval_tables()
+
+// network inputs, a piece is input `kind * 32 + square` for each side, its
+//  kinds => own man 0, own king 1, other man 2, other king 3 (white sees the board flipped)
+const short NNUE_FEATURE[2][17] = {
+	{[BLACK|MAN] = 0, [BLACK|KING] = 1, [WHITE|MAN] = 2, [WHITE|KING] = 3},
+	{[WHITE|MAN] = 0, [WHITE|KING] = 1, [BLACK|MAN] = 2, [BLACK|KING] = 3}
+};
+
+#define NNUE_INDEX(side, piece, sq) (NNUE_FEATURE[(side)][(piece)] * BOARD_SIZE + ((side) ? BOARD_SIZE-1 - (sq) : (sq)))
+
+// loaded network's first layer (see nnue_load()), NULL => accumulators arent kept
+const short* NNUE_WEIGHTS = NULL;   // [NNUE_INPUTS][NNUE_HIDDEN]
+const short* NNUE_BIASES = NULL;    // [NNUE_HIDDEN]
+
+// bitboard of a piece, white/black men/kings
+const short BITBOARD_INDEX[17] = {[WHITE|MAN] = 0, [WHITE|KING] = 1, [BLACK|MAN] = 2, [BLACK|KING] = 3};
+
+// piece-square sum of the men on the 8 squares of a board byte,
+//  [white/black][byte][men bits] (see init_weights())
+int PSQ_BYTES[2][4][256];
+
+// `piece` put on (sign 1) or taken off (sign -1) square `sq`
+#define eval_terms_update(game, sq, piece, sign) { \
+	(game)->code[HALF(sq)] += (sign) * PIECE_CODE[(piece)]; \
+	(game)->psq += (sign) * PSQ[(piece)][(sq)]; \
+	if ((piece) & MAN) \
+		(game)->menKey ^= zobristNumbers[(sq)][(piece)]; \
+	(game)->bitboard[BITBOARD_INDEX[(piece)]] ^= 1u << (sq); \
+	if (PATTERN_TERMS && PATTERN_STATE[(piece)]) \
+		for (short w_ = 0; w_ < PATTERN_WINDOWS; w_ += 1) \
+			(game)->pattern[w_] += (sign) * PATTERN_STATE[(piece)] * PATTERN_INDEX[(sq)][w_]; \
+	if (NNUE_WEIGHTS) { \
+		nnue_update((game)->accumulator[0], NNUE_WEIGHTS + NNUE_INDEX(0, (piece), (sq)) * NNUE_HIDDEN, (sign)); \
+		nnue_update((game)->accumulator[1], NNUE_WEIGHTS + NNUE_INDEX(1, (piece), (sq)) * NNUE_HIDDEN, (sign)); \
+	} \
+}
+
+
+/**
+ * Add (sign 1) or subtract (sign -1) a row
+ *  of first layer weights to an accumulator
+ */
+inline void nnue_update(short* acc, const short* row, int sign){
+#ifdef __AVX2__
+	for (int i = 0; i < NNUE_HIDDEN; i += 16){
+		__m256i a = _mm256_loadu_si256((__m256i*) (acc + i)),
+			w = _mm256_loadu_si256((__m256i*) (row + i));
+
+		a = (sign > 0) ? _mm256_add_epi16(a, w) : _mm256_sub_epi16(a, w);
+		_mm256_storeu_si256((__m256i*) (acc + i), a);
+	}
+#else
+	for (int i = 0; i < NNUE_HIDDEN; i += 1)
+		acc[i] += sign * row[i];
+#endif
+}
+
+
+/**
+ * Set up the pattern windows,
+ *  squares by rows, the first one is the most significant digit
+ */
+void init_patterns(){
+	short w = 0, k, sq, power;
+
+	for (short row = 0; row <= 4; row += 2){
+		for (short col = 0; col <= 4; col += 2, w += 1){
+			k = 0;
+
+			for (short r = row; r < row+4; r += 1)
+				for (short c = col; c < col+4; c += 1)
+					if ((r + c) & 1) // dark square
+						WINDOW_SQUARES[w][k++] = r*4 + c/2;
+
+			for (k = PATTERN_SQUARES-1, power = 1; k >= 0; k -= 1, power *= 3){
+				sq = WINDOW_SQUARES[w][k];
+				PATTERN_INDEX[sq][w] = power;
+			}
+		}
+	}
+}
+
+
+/**
+ * Set up the tables that come from WEIGHTS
+ *  (PSQ, PSQ_BYTES, POSITIONAL_MAX)
+ */
+void init_weights(){
+	int low = 0, high = 0, psq = 0;
+
+	for (short sq = 0; sq < BOARD_SIZE; sq += 1){
+		PSQ[BLACK|MAN][sq] = WEIGHTS.psq[sq];
+		PSQ[WHITE|MAN][sq] = -WEIGHTS.psq[BOARD_SIZE-1 - sq];
+
+		psq += abs(WEIGHTS.psq[sq]);
+	}
+
+	for (short color = 0; color < 2; color += 1){
+		short piece = color ? (BLACK|MAN) : (WHITE|MAN);
+
+		for (short k = 0; k < 4; k += 1)
+			for (short bits = 0; bits < 256; bits += 1){
+				PSQ_BYTES[color][k][bits] = 0;
+
+				for (short i = 0; i < 8; i += 1)
+					if (bits & (1 << i))
+						PSQ_BYTES[color][k][bits] += PSQ[piece][k*8 + i];
+			}
+	}
+
+	low = high = WEIGHTS.backrank_values[0];
+
+	for (short i = 1; i < 16; i += 1){
+		if (WEIGHTS.backrank_values[i] < low) low = WEIGHTS.backrank_values[i];
+		if (WEIGHTS.backrank_values[i] > high) high = WEIGHTS.backrank_values[i];
+	}
+
+	// balance (12 men on a side) + back rank + piece-square + c5 + e5 (2 squares)
+	POSITIONAL_MAX = 12 * abs(WEIGHTS.balance) + abs(WEIGHTS.backrank) * (high - low) + psq
+		+ abs(WEIGHTS.c5) + 2 * abs(WEIGHTS.e5);
+}
+
+
+/**
+ * Tables of the evaluation terms
+ *  (pattern windows, weight-derived bounds)
+ */
+void init_eval_tables(){
+	init_patterns();
+	init_weights();
+}
+
+
+/**
+ * Compute the evaluation terms from scratch
+ */
+void init_eval_terms(Gamestate* game){
+	run_once(&EVAL_TABLES_ONCE, init_eval_tables);
+
+	game->code[0] = game->code[1] = game->psq = 0;
+	game->menKey = 0;
+	memset(game->bitboard, 0, sizeof(game->bitboard));
+	memset(game->pattern, 0, sizeof(game->pattern));
+	memset(game->accumulator, 0, sizeof(game->accumulator));
+
+	if (NNUE_WEIGHTS){
+		memcpy(game->accumulator[0], NNUE_BIASES, sizeof(game->accumulator[0]));
+		memcpy(game->accumulator[1], NNUE_BIASES, sizeof(game->accumulator[1]));
+	}
+
+	for (int i = 0; i < BOARD_SIZE; i += 1){
+		short piece = game->board[i].value;
+
+		if (piece != FREE)
+			eval_terms_update(game, i, piece, 1);
+	}
+}
+
+
+/**
+ * Pack the position of game,
+ *  (result is left at 0)
+ */
+void pack_position(Gamestate* game, struct packed* p){
+	short piece;
+
+	*p = (struct packed) {0};
+	p->turn = game->turn != 0;
+
+	for (int i = 0; i < BOARD_SIZE; i += 1){
+		piece = game->board[i].value;
+
+		if (piece & BLACK) p->black |= 1u << i;
+		if (piece & WHITE) p->white |= 1u << i;
+		if (piece & KING) p->kings |= 1u << i;
+	}
+}
+
+
+/**
+ * Set up game from a packed position,
+ *  (with its hash key and evaluation terms)
+ */
+void unpack_position(const struct packed* p, Gamestate* game){
+	unsigned int bit;
+
+	for (int i = 0; i < BOARD_SIZE; i += 1){
+		bit = 1u << i;
+
+		game->board[i].value = (p->black & bit) ? BLACK : (p->white & bit) ? WHITE : FREE;
+
+		if (game->board[i].value != FREE)
+			game->board[i].value |= (p->kings & bit) ? KING : MAN;
+	}
+
+	game->turn = p->turn;
+	game->prev_from = game->prev_to = 0;
+
+	init_board_hash(game);
+}
+
+
+/**
+ * Hash key of the position after `move`,
+ *  without doing it (xor the changed squares into the current key)
+ */
+inline u64 movehashkey(Gamestate* game, Move* move){
+	field* b = game->board;
+
+	short from = move->list[0].from,
+		to = move->list[move->length-1].to,
+		piece = b[from].value,
+		sq;
+
+	// other side to move => complemented key
+	u64 key = ~game->zobristKey ^ zobristNumbers[from][piece];
+
+	for (short i = 0; i < move->length; i += 1){
+		sq = move->list[i].to;
+
+		if (move->is_capture)
+			key ^= zobristNumbers[move->list[i].piece][b[move->list[i].piece].value];
+
+		// promoted on the way, or at the end
+		if ((piece & MAN) && (((piece & WHITE) && sq >= 0 && sq <= 3) || ((piece & BLACK) && sq >= 28 && sq <= 31)))
+			piece = (piece & (WHITE|BLACK)) | KING;
+	}
+
+	return key ^ zobristNumbers[to][piece];
+}
+
+
 /**
  * Generates random 64-bit number
  */
@@ -522,9 +864,9 @@ short generate_captures(field board[BOARD_SIZE], short color, Movelist* all_capt
 					char diagonal[7];
 					short c = 0; // diagonal length
 					for (short j = 0; j < 8; j += 1){  // loop through diagonal
-						if ((short) KING_MOVES[i][l][j]){
-							diagonal[c++] = (short) KING_MOVES[i][l][j] - 1; // add square
-						}
+						if (!KING_MOVES[i][l][j]) break; // end of the diagonal
+
+						diagonal[c++] = (short) KING_MOVES[i][l][j] - 1; // add square
 
 						if (j >= 1){
 							// break if previous and current square in diagonal are not free
@@ -903,7 +1245,9 @@ inline void domove(Gamestate * game, Move * move){
 
 	short to=0,     // this moves' ending square
 		who,    // who is moving, black or white
-		piece;  // the jumping piece
+		piece,  // the jumping piece
+		first = move->list[0].from,
+		start = game->board[first].value;  // piece before the move
 
 
 	if (!move->is_capture){
@@ -985,6 +1329,13 @@ inline void domove(Gamestate * game, Move * move){
 			}
 		}
 
+		// evaluation terms, the piece (maybe promoted) moved and the captured ones removed
+		eval_terms_update(game, first, start, -1);
+		eval_terms_update(game, to, game->board[to].value, 1);
+
+		for (short i = 0; i < move->l; i += 1)
+			eval_terms_update(game, move->list[i].piece, move->captured[i].value, -1);
+
 		// toggle turn, between 0 and 1
 		game->turn = !game->turn;
 	}
@@ -1015,7 +1366,9 @@ inline void undomove(Gamestate * game, Move * move){
 	bool moved = false;
 
 	short from,    // where piece was before domove()
-		who;     // who jumped, black or white
+		who,     // who jumped, black or white
+		end = game->board[move->list[move->length-1].to].value,  // piece after the move
+		captures = move->l;
 
 
 	if (!move->is_capture){
@@ -1057,6 +1410,12 @@ inline void undomove(Gamestate * game, Move * move){
 
 
 	if (moved){
+		// evaluation terms, undo domove()'s update
+		eval_terms_update(game, move->list[move->length-1].to, end, -1);
+
+		for (short i = 0; i < captures; i += 1)
+			eval_terms_update(game, move->list[i].piece, move->captured[i].value, 1);
+
 		if (move->is_promotion){
 			// piece got promoted after doing this move,
 			//  now its undone, demote piece
@@ -1071,6 +1430,8 @@ inline void undomove(Gamestate * game, Move * move){
 			move->is_promotion = false;
 		}
 
+		eval_terms_update(game, move->list[0].from, game->board[move->list[0].from].value, 1);
+
 		// toggle turn, between 0 and 1
 		game->turn = !game->turn;
 	}
@@ -1084,7 +1445,7 @@ inline void undomove(Gamestate * game, Move * move){
 }
 
 
-short make_prime(short n){
+long make_prime(long n){
    if ((n & 1) == 0) n -= 1;
    while (!is_prime(n)) n -= 2;
    return n;
@@ -1111,9 +1472,9 @@ bool is_prime(long n){
 void insertion_sort( Move arr[], int sortVals[], int first_index, int last_index) {
 	Move mtmp;
 	register int itmp, j;
-	for (int i = first_index+1; i < last_index; i+=1) {
+	for (int i = first_index+1; i <= last_index; i+=1) {
 		j = i;
-		while (j > 0 && sortVals[j] > sortVals[j-1]) {
+		while (j > first_index && sortVals[j] > sortVals[j-1]) {
 			swap_move(&arr[j], &arr[j-1]);
 			swap_short(&sortVals[j], &sortVals[j-1]);
 			j--;
@@ -1125,8 +1486,8 @@ void insertion_sort( Move arr[], int sortVals[], int first_index, int last_index
 void quick_sort( Move array[], int sortVals[], int first_index, int last_index) {
 	register short
 		i = first_index,
-		j = last_index,
-		itmp;
+		j = last_index;
+	register int itmp;
 
 	Move mtmp;
 	long pivot = sortVals[(i+j)>>1];
@@ -0,0 +1,416 @@
+
+/*
+ * Kodra (Russian Draught Engine)
+ *
+ *  sys.c
+ *   Platform helpers (threads, atomics, locks, bits, clock, NUMA, mapped files)
+ *
+ * (C) Sochima Biereagu, 2017
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+
+	#ifdef USE_NUMA
+		#include <numa.h>
+	#endif
+
+	#define MPOL_BIND 2
+#endif
+
+
+/////////////
+// Threads //
+/////////////
+
+#ifdef _WIN32
+	typedef HANDLE thread_t;
+
+	#define THREAD_FUNC(name, arg) DWORD WINAPI name(LPVOID arg)
+	#define THREAD_RETURN return 0
+
+	typedef DWORD_PTR affinity_t;   // cpus a thread may run on
+#else
+	typedef pthread_t thread_t;
+
+	#define THREAD_FUNC(name, arg) void* name(void* arg)
+	#define THREAD_RETURN return NULL
+
+	typedef cpu_set_t affinity_t;
+#endif
+
+
+/////////////
+// Atomics //
+/////////////
+
+// (gcc builtins, also available on mingw)
+#define atomic_get(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_set(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)  // returns the old value
+
+
+///////////
+// Locks //
+///////////
+
+// spinlock, for short critical sections
+//  (zero-initialized => unlocked, no setup needed)
+typedef int lock_t;
+
+#define lock_acquire(l) while (__atomic_exchange_n((l), 1, __ATOMIC_ACQUIRE)) {}
+#define lock_release(l) __atomic_store_n((l), 0, __ATOMIC_RELEASE)
+
+// one-time initialization, see run_once()
+//  (zero-initialized => not run yet)
+typedef struct {
+	int done;
+	lock_t lock;
+} once_t;
+
+
+//////////
+// Bits //
+//////////
+
+// set bits of a 32 bit word (popcnt with -march supporting it)
+#define popcount(x) __builtin_popcount(x)
+
+
+////////////////
+// prototypes //
+////////////////
+
+bool thread_create(thread_t*, void*, void*);
+void thread_join(thread_t);
+bool thread_pin(int, affinity_t*);
+void thread_unpin(affinity_t*);
+int cpu_count();
+double clock_now();
+int cpu_node(int);
+void* node_alloc(size_t, int);
+void node_free(void*);
+void* file_map(const char*, size_t*);
+void file_unmap(void*, size_t);
+void run_once(once_t*, void (*)());
+
+
+/**
+ * Start a thread running `func(arg)`,
+ *  `func` must be declared with THREAD_FUNC()
+ *
+ * returns false if the thread couldnt be started
+ */
+bool thread_create(thread_t* thread, void* func, void* arg){
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) func, arg, 0, NULL);
+	return *thread != NULL;
+#else
+	return pthread_create(thread, NULL, (void* (*)(void*)) func, arg) == 0;
+#endif
+}
+
+
+/**
+ * Wait for a thread to finish
+ */
+void thread_join(thread_t thread){
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+
+/**
+ * Pin the calling thread to a cpu core,
+ *  `saved` (may be NULL) gets the cpus it could run on, for thread_unpin()
+ *
+ * returns false if the thread couldnt be pinned
+ */
+bool thread_pin(int cpu, affinity_t* saved){
+#ifdef _WIN32
+	DWORD_PTR previous;
+
+	if (cpu < 0 || cpu >= (int) sizeof(DWORD_PTR)*8) return false;
+
+	previous = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+	if (saved) *saved = previous;
+
+	return previous != 0;
+#else
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+
+	if (saved && pthread_getaffinity_np(pthread_self(), sizeof(*saved), saved) != 0)
+		return false;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+
+/**
+ * Let the calling thread run on the cpus it could before thread_pin()
+ */
+void thread_unpin(affinity_t* saved){
+#ifdef _WIN32
+	SetThreadAffinityMask(GetCurrentThread(), *saved);
+#else
+	pthread_setaffinity_np(pthread_self(), sizeof(*saved), saved);
+#endif
+}
+
+
+/**
+ * Number of cpu cores
+ */
+int cpu_count(){
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf(_SC_NPROCESSORS_CONF);
+#endif
+}
+
+
+/**
+ * Monotonic wall-clock time in seconds
+ *  (unlike clock(), counts time spent descheduled and
+ *  doesnt run faster with more threads)
+ */
+double clock_now(){
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart / freq.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+}
+
+
+//////////
+// NUMA //
+//////////
+
+#define NODE_HEADER 64   // keeps the allocation size, one cache line
+
+/**
+ * NUMA node of a cpu core
+ *  (0 if unknown)
+ */
+int cpu_node(int cpu){
+#ifdef _WIN32
+	UCHAR node;
+
+	if (cpu < 0 || !GetNumaProcessorNode((UCHAR) cpu, &node)) return 0;
+	return node;
+#elif defined(USE_NUMA)
+	int node;
+
+	if (cpu < 0 || numa_available() < 0) return 0;
+
+	node = numa_node_of_cpu(cpu);
+	return node < 0 ? 0 : node;
+#else
+	// sysfs lists the node as cpuN/nodeM
+	char path[64];
+	struct dirent* e;
+	DIR* dir;
+	int node = 0;
+
+	if (cpu < 0) return 0;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+	if (!(dir = opendir(path))) return 0;
+
+	while ((e = readdir(dir))){
+		if (strncmp(e->d_name, "node", 4) == 0 && isdigit(e->d_name[4])){
+			node = atoi(e->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return node;
+#endif
+}
+
+
+/**
+ * Allocate zeroed memory on a NUMA node,
+ *  (node < 0 => no placement), free with node_free()
+ *
+ * uses libnuma if built with USE_NUMA, else mbind()
+ */
+void* node_alloc(size_t bytes, int node){
+	char* p;
+
+	bytes += NODE_HEADER;
+
+#ifdef _WIN32
+	p = (node >= 0)
+		? VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE, node)
+		: VirtualAlloc(NULL, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+
+	if (!p) return NULL;
+#elif defined(USE_NUMA)
+	if (node >= 0 && numa_available() >= 0){
+		p = numa_alloc_onnode(bytes, node);
+	} else {
+		p = numa_alloc(bytes);
+	}
+
+	if (!p) return NULL;
+
+	memset(p, 0, bytes); // fault the pages in on the node
+#else
+	p = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) return NULL;
+
+	if (node >= 0){
+		unsigned long mask = 1UL << node;
+
+		if (node < (int) sizeof(mask)*8){
+			syscall(SYS_mbind, p, bytes, MPOL_BIND, &mask, sizeof(mask)*8, 0);
+		}
+		memset(p, 0, bytes); // fault the pages in on the node
+	}
+#endif
+
+	*(size_t*) p = bytes;
+	return p + NODE_HEADER;
+}
+
+
+/**
+ * Free memory from node_alloc()
+ */
+void node_free(void* ptr){
+	char* p = ptr;
+
+	if (!p) return;
+
+	p -= NODE_HEADER;
+
+#ifdef _WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#elif defined(USE_NUMA)
+	numa_free(p, *(size_t*) p);
+#else
+	munmap(p, *(size_t*) p);
+#endif
+}
+
+
+///////////
+// Files //
+///////////
+
+/**
+ * Map a file into memory (read only),
+ *  `size` gets its size in bytes, unmap with file_unmap()
+ *
+ * returns NULL if the file cant be opened or is empty
+ */
+void* file_map(const char* path, size_t* size){
+#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER bytes;
+	void* p = NULL;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+
+	if (GetFileSizeEx(file, &bytes) && bytes.QuadPart > 0){
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		if (mapping){
+			p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping); // (the view keeps it open)
+		}
+	}
+	CloseHandle(file);
+
+	if (!p) return NULL;
+
+	*size = bytes.QuadPart;
+	return p;
+#else
+	struct stat st;
+	void* p;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size <= 0){
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // (the mapping keeps it open)
+
+	if (p == MAP_FAILED) return NULL;
+
+	*size = st.st_size;
+	return p;
+#endif
+}
+
+
+/**
+ * Unmap a file from file_map()
+ */
+void file_unmap(void* p, size_t size){
+	if (!p) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(p);
+#else
+	munmap(p, size);
+#endif
+}
+
+
+/**
+ * Run `func` the first time it's called with `once`,
+ *  from any thread, the other callers wait until it returned
+ */
+void run_once(once_t* once, void (*func)()){
+	if (atomic_get(&once->done))
+		return;
+
+	lock_acquire(&once->lock);
+		if (!once->done){
+			func();
+			atomic_set(&once->done, 1);
+		}
+	lock_release(&once->lock);
+}
@@ -0,0 +1,38 @@
+
+/*
+ * Kodra (Russian Draught Engine)
+ *
+ *  weights.c
+ *   The default evaluation weights, a `struct weights` initializer (see move.c),
+ *   also a weights file ('set weights <file>' loads files in this format)
+ *
+ * (C) Sochima Biereagu, 2017
+*/
+
+{
+	.man = 200,
+	.king = 500,
+
+	.exchange = 400,       // favor exchanges if in material plus, * (v1-v2) / (v1+v2)
+	.turn = 3,             // color to move
+	.balance = 2,          // per man more on one side of the board
+	.king_balance = 500,   // kings against none
+
+	.backrank = 3,         // multiplier for back rank
+	.backrank_values = {0, -1, 1, 0, 3, 3, 3, 3, 1, 1, 2, 2, 4, 4, 9, 8},
+
+	// black men on squares 1..32 (center control, edges, squares c5, f6, d6), white's are mirrored
+	.psq = {
+		 0,  0,  0,  0,
+		-2,  0,  0,  0,
+		 0,  2,  2, -2,
+		-2,  2,  2,  0,
+		 0,  0,  9, -2,
+		-2,  7,  7,  0,
+		 0,  0,  0, -2,
+		 0,  0,  0,  0
+	},
+
+	.c5 = 5,               // square c5 (see evaluate())
+	.e5 = 3,               // square e5, by the number of pieces
+}
@@ -0,0 +1,126 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Batch evaluation benchmark
+ *  evaluate_batch() and each of its kernels must give evaluate()'s scores
+ *  of the unpacked positions (random games, to their end sometimes), then
+ *  positions per second of evaluating the packed positions one at a time
+ *  (unpacked, and evaluate_bits()) and of each kernel
+ *
+ *  usage: batch [positions] [weights file]
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+#include "random_game.h"
+
+#define ROUNDS 20   // passes over the positions, for the speed
+
+// a kernel, n a multiple of its lanes
+struct kernel {
+	char* name;
+	void (*run)(const struct packed*, int, int*);
+	int lanes;
+} KERNELS[] = {
+	{"scalar", evaluate_batch_scalar, 1},
+#ifdef __AVX2__
+	{"avx2", evaluate_batch_avx2, 8},
+#endif
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+	{"avx512", evaluate_batch_avx512, 16},
+#endif
+	{"evaluate_batch", evaluate_batch, 1},
+};
+
+#define KERNELS_N (sizeof(KERNELS) / sizeof(struct kernel))
+
+
+// evaluate_batch() one position at a time, unpacked
+void unpacked_run(const struct packed* positions, int n, int* scores){
+	Gamestate game;
+
+	for (int i = 0; i < n; i += 1){
+		unpack_position(&positions[i], &game);
+		scores[i] = evaluate(&game, game.turn ? WHITE : BLACK, 0, -EVAL_INF, EVAL_INF, NULL);
+	}
+}
+
+
+// positions per second of `run`
+double batch_speed(void (*run)(const struct packed*, int, int*), const struct packed* positions, int n, int* scores, int* checksum){
+	double start = clock_now();
+
+	for (int r = 0; r < ROUNDS; r += 1){
+		run(positions, n, scores);
+		*checksum += scores[r % n];
+	}
+
+	return (double) ROUNDS * n / (clock_now() - start);
+}
+
+
+int main(int argc, char** argv){
+	int positions = (argc > 1) ? atoi(argv[1]) : 100000;
+
+	Gamestate* game = &(Gamestate){};
+	struct packed* packed = malloc(positions * sizeof(struct packed));
+	int* expected = malloc(positions * sizeof(int));
+	int* scores = malloc(positions * sizeof(int));
+	int wrong = 0, checksum = 0, n;
+
+	if (argc > 2 && !weights_load(argv[2])){
+		fprintf(stderr, "cant load %s\n", argv[2]);
+		return 1;
+	}
+
+	// (zobrist numbers first, they reseed rand()) same positions every run
+	init_board_hash(game);
+	srand(2017);
+
+	EVAL = EVAL_HANDWRITTEN;
+
+	for (int p = 0; p < positions; p += 1){
+		random_game(game, 10 + rand() % 60);
+		game->turn = rand() & 1;
+
+		pack_position(game, &packed[p]);
+	}
+
+	unpacked_run(packed, positions, expected);
+
+	// every kernel on all the positions it takes (and odd counts)
+	for (int k = 0; k < KERNELS_N; k += 1){
+		for (int part = 0; part < 2; part += 1){
+			n = part ? positions - positions % KERNELS[k].lanes : 37 - 37 % KERNELS[k].lanes;
+			n = min(n, positions - positions % KERNELS[k].lanes);
+
+			memset(scores, 0, n * sizeof(int));
+			KERNELS[k].run(packed, n, scores);
+
+			for (int p = 0; p < n; p += 1){
+				if (scores[p] != expected[p]){
+					if (!wrong) printf("position %d: evaluate %d, %s %d\n", p, expected[p], KERNELS[k].name, scores[p]);
+					wrong += 1;
+				}
+			}
+		}
+	}
+
+	printf("%d positions, %d batch scores differ (%d lanes in evaluate_batch)\n\n", positions, wrong, BATCH_LANES);
+
+	printf("unpack + evaluate  => %10.0f positions/s\n", batch_speed(unpacked_run, packed, positions, scores, &checksum));
+
+	for (int k = 0; k < KERNELS_N; k += 1){
+		n = positions - positions % KERNELS[k].lanes;
+		printf("%-18s => %10.0f positions/s\n", KERNELS[k].name, batch_speed(KERNELS[k].run, packed, n, scores, &checksum));
+	}
+
+	printf("(checksum %d)\n", checksum);
+
+	free(packed), free(expected), free(scores);
+
+	return wrong ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Evaluator identity
+ *  the branch free bitboard evaluator must give the handwritten
+ *  evaluator's scores, compared on random positions (games played
+ *  from the starting position, to their end sometimes) for both sides,
+ *  then the speed of both
+ *
+ *  usage: evalcheck [positions]
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+#include "random_game.h"
+
+#define ROUNDS 100   // evaluations of each position, for the speed
+
+
+// evaluations per second of evaluator `eval`
+double eval_speed(Gamestate* games, int positions, int eval, int* checksum){
+	double start = clock_now();
+
+	EVAL = eval;
+
+	for (int r = 0; r < ROUNDS; r += 1)
+		for (int p = 0; p < positions; p += 1)
+			*checksum += evaluate(&games[p], (r & 1) ? WHITE : BLACK, r & 7, -EVAL_INF, EVAL_INF, NULL);
+
+	return (double) ROUNDS * positions / (clock_now() - start);
+}
+
+
+int main(int argc, char** argv){
+	int positions = (argc > 1) ? atoi(argv[1]) : 100000;
+
+	Gamestate* games = malloc(positions * sizeof(Gamestate));
+	int wrong = 0, kings = 0, over = 0, checksum[2] = {0}, color, depth, x, y;
+
+	// (zobrist numbers first, they reseed rand()) same positions every run
+	init_board_hash(&(Gamestate){});
+	srand(2017);
+
+	for (int p = 0; p < positions; p += 1){
+		random_game(&games[p], 10 + rand() % 60);
+
+		kings += (games[p].bitboard[1] | games[p].bitboard[3]) != 0;
+		over += !(games[p].bitboard[0] | games[p].bitboard[1]) || !(games[p].bitboard[2] | games[p].bitboard[3]);
+
+		for (int i = 0; i < 2; i += 1){
+			color = i ? WHITE : BLACK, depth = rand() % MAXDEPTH;
+
+			EVAL = EVAL_HANDWRITTEN;
+			x = evaluate(&games[p], color, depth, -EVAL_INF, EVAL_INF, NULL);
+
+			EVAL = EVAL_BITBOARD;
+			y = evaluate(&games[p], color, depth, -EVAL_INF, EVAL_INF, NULL);
+
+			if (x != y){
+				if (!wrong) printf("position %d, %s to move: handwritten %d, bitboard %d\n", p, i ? "white" : "black", x, y);
+				wrong += 1;
+			}
+		}
+	}
+
+	printf("%d positions (%d with kings, %d with a side captured), %d scores differ\n", positions, kings, over, wrong);
+
+	printf("handwritten => %10.0f evals/s\n", eval_speed(games, positions, EVAL_HANDWRITTEN, &checksum[0]));
+	printf("bitboard    => %10.0f evals/s\n", eval_speed(games, positions, EVAL_BITBOARD, &checksum[1]));
+
+	free(games);
+
+	return (wrong || checksum[0] != checksum[1]) ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Network benchmark
+ *  evaluations per second of the network (incremental first layer)
+ *  and the handwritten evaluator on random positions, domove()/undomove()
+ *  cost with the accumulators, and the AVX2 kernels against the scalar ones
+ *
+ *  usage: nnue [network file] [positions]
+ *   (a missing file gets a material-only network: 200 a man, 496 a king,
+ *    random weights on the other units; load it with 'set evalfile <file>')
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+#include "random_game.h"
+
+#define ROUNDS 200   // evaluations of each position
+
+
+// random in -r..r
+int noise(int r){
+	return rand() % (2*r + 1) - r;
+}
+
+
+// material network, units 0/1 count own men/kings (x8) through every layer
+bool write_network(const char* path){
+	static short input_weights[NNUE_INPUTS][NNUE_HIDDEN], input_biases[NNUE_HIDDEN];
+	static signed char l1_weights[NNUE_L1][2*NNUE_HIDDEN], l2_weights[NNUE_L2][NNUE_L1], out_weights[NNUE_L2] = {25, 62, -25, -62};
+	static int l1_biases[NNUE_L1], l2_biases[NNUE_L2], out_bias = 0;
+
+	struct network header = {"KDNN", NNUE_INPUTS, NNUE_HIDDEN, NNUE_L1, NNUE_L2, 1};
+	FILE* out;
+
+	for (int i = 0; i < NNUE_INPUTS; i += 1)
+		for (int j = 2; j < NNUE_HIDDEN; j += 1)
+			input_weights[i][j] = noise(8);
+
+	for (int sq = 0; sq < BOARD_SIZE; sq += 1){
+		input_weights[0*BOARD_SIZE + sq][0] = 8;   // own man
+		input_weights[1*BOARD_SIZE + sq][1] = 8;   // own king
+	}
+
+	for (int j = 2; j < NNUE_HIDDEN; j += 1)
+		input_biases[j] = noise(64);
+
+	for (int j = 4; j < NNUE_L1; j += 1){
+		l1_biases[j] = noise(1024);
+
+		for (int i = 0; i < 2*NNUE_HIDDEN; i += 1)
+			l1_weights[j][i] = noise(16);
+	}
+
+	for (int j = 4; j < NNUE_L2; j += 1){
+		l2_biases[j] = noise(1024);
+
+		for (int i = 0; i < NNUE_L1; i += 1)
+			l2_weights[j][i] = noise(16);
+	}
+
+	// own men/kings, other men/kings passed on (x64 >> NNUE_SHIFT)
+	l1_weights[0][0] = l1_weights[1][1] = 64;
+	l1_weights[2][NNUE_HIDDEN] = l1_weights[3][NNUE_HIDDEN+1] = 64;
+
+	for (int j = 0; j < 4; j += 1)
+		l2_weights[j][j] = 64;
+
+	if (!(out = fopen(path, "wb")))
+		return false;
+
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(input_weights, sizeof(input_weights), 1, out);
+	fwrite(input_biases, sizeof(input_biases), 1, out);
+	fwrite(l1_weights, sizeof(l1_weights), 1, out);
+	fwrite(l1_biases, sizeof(l1_biases), 1, out);
+	fwrite(l2_weights, sizeof(l2_weights), 1, out);
+	fwrite(l2_biases, sizeof(l2_biases), 1, out);
+	fwrite(out_weights, sizeof(out_weights), 1, out);
+	fwrite(&out_bias, sizeof(out_bias), 1, out);
+	fclose(out);
+
+	printf("%s => %lu bytes (material network)\n", path, (unsigned long) NNUE_FILE_SIZE);
+	return true;
+}
+
+
+// evaluations per second of the current evaluator
+double eval_speed(Gamestate* games, int positions, int* checksum){
+	double start = clock_now();
+
+	for (int r = 0; r < ROUNDS; r += 1)
+		for (int p = 0; p < positions; p += 1)
+			*checksum += evaluate(&games[p], (r & 1) ? WHITE : BLACK, 0, -EVAL_INF, EVAL_INF, NULL);
+
+	return (double) ROUNDS * positions / (clock_now() - start);
+}
+
+
+// domove()/undomove() pairs per second
+double move_speed(Gamestate* games, int positions){
+	Movelist moves;
+	long n = 0;
+	double start = clock_now();
+
+	for (int r = 0; r < ROUNDS/10; r += 1){
+		for (int p = 0; p < positions; p += 1){
+			generate_all_moves(&games[p], games[p].turn, &moves);
+
+			for (int i = 0; i < moves.length; i += 1, n += 1){
+				domove(&games[p], &moves.moves[i]);
+				undomove(&games[p], &moves.moves[i]);
+			}
+		}
+	}
+
+	return n / (clock_now() - start);
+}
+
+
+int main(int argc, char** argv){
+	char* path = (argc > 1) ? argv[1] : "nnue.bin";
+	int positions = (argc > 2) ? atoi(argv[2]) : 10000;
+
+	Gamestate* games = malloc(positions * sizeof(Gamestate));
+	int checksum = 0, wrong = 0, material, code, p;
+	bool generated = false;
+	double speed;
+
+	// (zobrist numbers first, they reseed rand()) same positions every run
+	init_board_hash(&(Gamestate){});
+	srand(2017);
+
+	if (!nnue_load(path)){
+		if (!write_network(path) || !nnue_load(path)){
+			fprintf(stderr, "cant load %s\n", path);
+			return 1;
+		}
+
+		generated = true;
+	}
+
+	for (p = 0; p < positions; ){
+		if (random_game(&games[p], 10 + rand() % 40))
+			p += 1;
+	}
+
+	// the material network must count the material
+	if (generated){
+		EVAL = EVAL_NNUE;
+
+		for (p = 0; p < positions; p += 1){
+			code = games[p].code[0] + games[p].code[1];
+			material = 200 * ((code >> 8) % 16 - code % 16) + 496 * ((code >> 12) % 16 - (code >> 4) % 16);
+
+			if ((code & 0xFF) && (code >> 8) && evaluate(&games[p], BLACK, 0, -EVAL_INF, EVAL_INF, NULL) != material)
+				wrong += 1;
+		}
+
+		printf("material network => %d/%d positions wrong\n", wrong, positions);
+	}
+
+#ifdef __AVX2__
+	// same outputs from both kernels
+	unsigned char in[2][2*NNUE_HIDDEN];
+	int out[2][NNUE_L1];
+
+	for (p = wrong = 0; p < positions; p += 1){
+		nnue_transform_scalar(games[p].accumulator[0], games[p].accumulator[1], in[0]);
+		nnue_transform_avx2(games[p].accumulator[0], games[p].accumulator[1], in[1]);
+
+		nnue_layer_scalar(in[0], 2*NNUE_HIDDEN, NNUE.l1_weights, NNUE.l1_biases, NNUE_L1, out[0]);
+		nnue_layer_avx2(in[1], 2*NNUE_HIDDEN, NNUE.l1_weights, NNUE.l1_biases, NNUE_L1, out[1]);
+
+		if (memcmp(in[0], in[1], sizeof(in[0])) || memcmp(out[0], out[1], sizeof(out[0])))
+			wrong += 1;
+	}
+
+	printf("avx2 kernels => %d/%d positions differ from scalar\n", wrong, positions);
+#else
+	printf("avx2 kernels => not built (scalar)\n");
+#endif
+
+	printf("\n%d positions, %d rounds\n", positions, ROUNDS);
+
+	EVAL = EVAL_NNUE;
+	speed = eval_speed(games, positions, &checksum);
+	printf("nnue        => %10.0f evals/s\n", speed);
+
+	EVAL = EVAL_HANDWRITTEN;
+	speed = eval_speed(games, positions, &checksum);
+	printf("handwritten => %10.0f evals/s\n", speed);
+
+	speed = move_speed(games, positions);
+	printf("\ndomove/undomove, accumulators    => %10.0f /s\n", speed);
+
+	nnue_free();
+
+	speed = move_speed(games, positions);
+	printf("domove/undomove, no accumulators => %10.0f /s\n", speed);
+
+	printf("(checksum %d)\n", checksum);
+
+	free(games);
+}
@@ -0,0 +1,70 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * NUMA benchmark
+ *  nodes per second of one search per core, with the search
+ *  threads left to the scheduler and then pinned (TTables on the
+ *  core's NUMA node)
+ *
+ *  usage: numa [searches] [seconds]
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+
+
+// run `n` searches at once, returns the total nodes per second
+double bench(int n, double seconds, bool pin){
+	struct search* s = calloc(n, sizeof(struct search));
+	double nps = 0;
+
+	NUMA = pin;
+
+	for (int i = 0; i < n; i += 1){
+		startBoard(&s[i].game, INIT_BOARD);
+
+		s[i].color = (i & 1) ? WHITE : BLACK;
+		s[i].cpu = pin ? i : -1;
+
+		tables_alloc(&s[i].TTable_deep, &s[i].TTable_big, s[i].cpu);
+
+		timer_start(&s[i].timer, seconds, &s[i].play);
+		s[i].timer.soft = s[i].timer.hard = seconds;
+	}
+
+	for (int i = 0; i < n; i += 1){
+		search_begin(&s[i]);
+	}
+
+	for (int i = 0; i < n; i += 1){
+		search_join(&s[i]);
+
+		nps += s[i].live.info.nodes / s[i].live.info.time;
+		tables_free(s[i].TTable_deep, s[i].TTable_big);
+	}
+
+	free(s);
+	return nps;
+}
+
+
+int main(int argc, char** argv){
+	int n = (argc > 1) ? atoi(argv[1]) : cpu_count();
+	double seconds = (argc > 2) ? atof(argv[2]) : 5;
+
+	double free_nps, pinned_nps;
+
+	printf("%d searches, %.1fs each, TTables %lukb\n\n", n, seconds,
+		(unsigned long) ((DEEP_HASHTABLE_SIZE + BIG_HASHTABLE_SIZE) * sizeof(struct TEntry) / 1024));
+
+	free_nps = bench(n, seconds, false);
+	printf("not pinned => %1.fnps\n", free_nps);
+
+	pinned_nps = bench(n, seconds, true);
+	printf("pinned     => %1.fnps (node of cpu 0 => %d)\n", pinned_nps, cpu_node(0));
+
+	printf("\nspeedup => %.3f\n", pinned_nps / free_nps);
+}
@@ -0,0 +1,100 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Pattern tables
+ *  writes pattern tables with the handwritten evaluator's linear
+ *  terms (material, center, edges, key squares), spread over the
+ *  windows covering each square, then maps them back and compares
+ *  both evaluators on random positions
+ *
+ *  usage: patterns [tables file] [positions]
+ *   (load the file in the engine with 'set patterns <file>')
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+#include "random_game.h"
+
+
+int main(int argc, char** argv){
+	char* path = (argc > 1) ? argv[1] : "patterns.bin";
+	int positions = (argc > 2) ? atoi(argv[2]) : 10000;
+
+	static short weights[PATTERN_WINDOWS][PATTERN_STATES];
+	struct patterns header = {"KDPT", PATTERN_WINDOWS, PATTERN_STATES, WEIGHTS.king, WEIGHTS.turn};
+
+	int cover[BOARD_SIZE] = {0}, piece, p, d;
+	double value, diff = 0, maxdiff = 0;
+
+	Gamestate* game = &(Gamestate){};
+	FILE* out;
+
+	init_patterns();
+	init_weights();
+
+	for (int w = 0; w < PATTERN_WINDOWS; w += 1)
+		for (int k = 0; k < PATTERN_SQUARES; k += 1)
+			cover[WINDOW_SQUARES[w][k]] += 1;
+
+	// weight of a window => its men's values, shared with the other windows on their squares
+	for (int w = 0; w < PATTERN_WINDOWS; w += 1){
+		for (int i = 0; i < PATTERN_STATES; i += 1){
+			value = 0;
+
+			for (int k = PATTERN_SQUARES-1, n = i; k >= 0; k -= 1, n /= 3){
+				int sq = WINDOW_SQUARES[w][k];
+
+				if (!(n % 3)) continue;
+
+				piece = (n % 3 == 1) ? (WHITE|MAN) : (BLACK|MAN);
+				value += (double) (((piece & BLACK) ? WEIGHTS.man : -WEIGHTS.man) + PSQ[piece][sq]) / cover[sq];
+			}
+
+			weights[w][i] = lround(value);
+		}
+	}
+
+	if (!(out = fopen(path, "wb"))){
+		fprintf(stderr, "cant write %s\n", path);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(weights, sizeof(weights), 1, out);
+	fclose(out);
+
+	printf("%s => %lu bytes\n", path, (unsigned long) (sizeof(header) + sizeof(weights)));
+
+	if (!patterns_load(path)){
+		fprintf(stderr, "cant load %s\n", path);
+		return 1;
+	}
+
+	// compare the evaluators
+	// (zobrist numbers first, they reseed rand()) same positions every run
+	init_board_hash(&(Gamestate){});
+	srand(2017);
+
+	for (p = 0; p < positions; ){
+		if (!random_game(game, 10 + rand() % 40))
+			continue;
+
+		p += 1;
+
+		EVAL = EVAL_HANDWRITTEN;
+		d = evaluate(game, BLACK, 0, -EVAL_INF, EVAL_INF, NULL);
+
+		EVAL = EVAL_PATTERNS;
+		d -= evaluate(game, BLACK, 0, -EVAL_INF, EVAL_INF, NULL);
+
+		diff += abs(d);
+		maxdiff = fmax(maxdiff, abs(d));
+	}
+
+	printf("%d positions, handwritten - patterns => mean %.1f, max %.0f\n", positions, diff / positions, maxdiff);
+
+	patterns_free();
+}
@@ -0,0 +1,130 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * ProbCut data
+ *  searches a corpus of quiet positions (random games from the
+ *  starting position) with iterative deepening, and fits
+ *  deep = a * shallow + b (+ error sigma) for each depth reduction
+ *
+ *  usage: probcut [positions] [depth] [pairs file]
+ *   (the pairs file gets "depth shallow-depth shallow-score deep-score" lines)
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include <math.h>   // (before game.c's log macro)
+
+#include "../src/ai.c"
+#include "random_game.h"
+
+#define MIN_REDUCTION 2
+#define MAX_REDUCTION 6
+#define MIN_DEEP 6        // only depths ProbCut could be tried at
+
+// sums for the regression of one reduction
+struct fit {
+	double n, x, y, xx, xy, yy;
+} fits[MAX_REDUCTION+1];
+
+
+// quiet, with moves
+bool quiet_position(Gamestate* game){
+	Movelist moves;
+
+	generate_all_moves(game, game->turn, &moves);
+
+	return moves.length > 1 && !moves.moves[0].is_capture;
+}
+
+
+int main(int argc, char** argv){
+	int positions = (argc > 1) ? atoi(argv[1]) : 200,
+		depth = (argc > 2) ? atoi(argv[2]) : 10;
+
+	FILE* out = (argc > 3) ? fopen(argv[3], "w") : NULL;
+
+	Gamestate* game = &(Gamestate){};
+	struct TEntry *TTable_deep, *TTable_big;
+	struct info* info = malloc(sizeof(struct info));
+	struct timer timer;
+	Move best;
+
+	int v[MAXDEPTH], inf = MATE*10, play = 0, nodes = 0, c, p, d, r;
+
+	depth = min(depth, MAXDEPTH-1);
+
+	// no cuts in the searches we measure
+	PROBCUT_DEPTH = 0;
+
+	lmr_init();
+	evalcache_alloc();
+
+	// same zobrist numbers and games every run
+	init_board_hash(game);
+	srand(2017);
+
+	for (int i = 0; i < BOARD_SIZE; i += 1)
+		for (int j = 0; j <= 16; j += 1)
+			zobristNumbers[i][j] = rand64();
+
+	for (p = 0; p < positions; ){
+		if (!random_game(game, 10 + rand() % 30) || !quiet_position(game))
+			continue;
+
+		p += 1;
+
+		c = game->turn ? -1 : 1;
+
+		memset(info, 0, sizeof(struct info));
+		tables_alloc(&TTable_deep, &TTable_big, -1);
+		timer_start(&timer, NO_TIME_LIMIT, &play);
+
+		for (d = 1; d <= depth; d += 1){
+			v[d] = negamax(game, 0, d, c, -inf, inf, &best, TTable_deep, TTable_big, info, &timer, &nodes, true);
+		}
+
+		tables_free(TTable_deep, TTable_big);
+
+		for (d = MIN_DEEP; d <= depth; d += 1){
+			for (r = MIN_REDUCTION; r <= MAX_REDUCTION && d-r >= 1; r += 1){
+				double x = v[d-r], y = v[d];
+
+				// decided positions say nothing about the margins
+				if (abs(v[d]) >= MATE-MAXDEPTH || abs(v[d-r]) >= MATE-MAXDEPTH)
+					continue;
+
+				fits[r].n += 1;
+				fits[r].x += x, fits[r].y += y;
+				fits[r].xx += x*x, fits[r].xy += x*y, fits[r].yy += y*y;
+
+				if (out) fprintf(out, "%d %d %d %d\n", d, d-r, v[d-r], v[d]);
+			}
+		}
+
+		if (p % 20 == 0) fprintf(stderr, "%d/%d\n", p, positions);
+	}
+
+	if (out) fclose(out);
+
+	printf("%d positions, deep depths %d-%d, %d nodes\n\n", positions, MIN_DEEP, depth, nodes);
+	printf("reduction   pairs        a          b      sigma        r\n");
+
+	for (r = MIN_REDUCTION; r <= MAX_REDUCTION; r += 1){
+		struct fit* f = &fits[r];
+
+		if (f->n < 2) continue;
+
+		double cov = f->xy/f->n - (f->x/f->n) * (f->y/f->n),
+			varx = f->xx/f->n - (f->x/f->n) * (f->x/f->n),
+			vary = f->yy/f->n - (f->y/f->n) * (f->y/f->n),
+			a = cov / varx,
+			b = f->y/f->n - a * f->x/f->n,
+			sigma = sqrt(fmax(vary - a*cov, 0));
+
+		printf("%9d %7.0f %8.3f %10.2f %10.2f %8.3f\n", r, f->n, a, b, sigma, cov / sqrt(varx*vary));
+	}
+
+	free(info);
+}
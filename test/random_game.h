@@ -0,0 +1,38 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Random games for the test tools,
+ *  include after "../src/ai.c"; the moves come from rand(), so seed it
+ *  (after init_board_hash(), which reseeds it) for the same games every run
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+#ifndef RANDOM_GAME_H
+#define RANDOM_GAME_H
+
+
+/**
+ * Random game from the starting position, up to `plies`
+ *  false if it ends (no moves) before
+ */
+bool random_game(Gamestate* game, int plies){
+	Movelist moves;
+
+	startBoard(game, INIT_BOARD);
+	game->turn = 1; // white starts
+
+	for (int i = 0; i < plies; i += 1){
+		generate_all_moves(game, game->turn, &moves);
+
+		if (!moves.length)
+			return false;
+
+		domove(game, &moves.moves[rand() % moves.length]);
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,180 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Search benchmark
+ *  fixed depth search of a set of middlegame positions,
+ *  (fresh TTables and heuristics for each position)
+ *
+ *  usage: bench [depth]
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include "../src/ai.c"
+
+#define w (WHITE|MAN)
+#define b (BLACK|MAN)
+#define W (WHITE|KING)
+#define B (BLACK|KING)
+#define _ FREE
+
+#define POSITIONS 8
+
+
+int positions[POSITIONS][8][4] = {
+	// 1. black to move
+	{
+		{  b,  b,  b,  b},
+		{_,  _,  b,  _  },
+		{  b,  _,  _,  b},
+		{_,  _,  b,  b  },
+		{  _,  b,  _,  w},
+		{w,  w,  _,  _  },
+		{  w,  w,  w,  _},
+		{w,  w,  w,  _  }
+	},
+	// 2. white to move
+	{
+		{  _,  b,  b,  b},
+		{_,  b,  b,  b  },
+		{  b,  _,  _,  b},
+		{w,  _,  _,  _  },
+		{  _,  _,  _,  w},
+		{_,  _,  w,  _  },
+		{  _,  _,  _,  w},
+		{w,  w,  w,  w  }
+	},
+	// 3. black to move
+	{
+		{  b,  b,  _,  b},
+		{b,  _,  b,  b  },
+		{  _,  _,  _,  b},
+		{b,  b,  _,  _  },
+		{  _,  _,  w,  b},
+		{w,  w,  _,  _  },
+		{  w,  w,  w,  _},
+		{_,  w,  w,  w  }
+	},
+	// 4. black to move
+	{
+		{  _,  _,  b,  b},
+		{b,  b,  _,  _  },
+		{  b,  _,  b,  b},
+		{_,  _,  _,  b  },
+		{  _,  _,  _,  _},
+		{b,  w,  _,  w  },
+		{  _,  w,  w,  w},
+		{w,  w,  w,  _  }
+	},
+	// 5. white to move
+	{
+		{  b,  b,  b,  b},
+		{b,  b,  _,  _  },
+		{  b,  _,  _,  _},
+		{_,  _,  w,  b  },
+		{  w,  _,  _,  b},
+		{_,  w,  _,  _  },
+		{  w,  _,  w,  b},
+		{w,  w,  w,  w  }
+	},
+	// 6. white to move
+	{
+		{  b,  b,  b,  _},
+		{_,  b,  b,  _  },
+		{  b,  _,  _,  b},
+		{_,  b,  _,  _  },
+		{  _,  _,  w,  _},
+		{b,  w,  _,  _  },
+		{  _,  _,  w,  w},
+		{w,  w,  w,  w  }
+	},
+	// 7. white to move
+	{
+		{  b,  _,  b,  b},
+		{_,  b,  b,  b  },
+		{  b,  _,  _,  _},
+		{b,  b,  _,  w  },
+		{  _,  _,  _,  w},
+		{w,  w,  _,  _  },
+		{  w,  w,  _,  _},
+		{w,  w,  w,  w  }
+	},
+	// 8. black to move
+	{
+		{  b,  b,  b,  b},
+		{b,  _,  b,  _  },
+		{  _,  _,  _,  _},
+		{b,  b,  _,  w  },
+		{  _,  _,  w,  _},
+		{w,  w,  _,  _  },
+		{  w,  _,  _,  _},
+		{w,  w,  _,  w  }
+	}
+};
+
+int colors[POSITIONS] = {BLACK, WHITE, BLACK, BLACK, WHITE, WHITE, WHITE, BLACK};
+
+
+int main(int argc, char** argv){
+	int depth = (argc > 1) ? atoi(argv[1]) : 14;
+
+	Gamestate* game = &(Gamestate){};
+	struct TEntry *TTable_deep, *TTable_big;
+	struct timer timer;
+	struct live live;
+	char str[1024];
+	int play = 0, res;
+
+	double time = 0;
+	long nodes = 0;
+	unsigned long cutoffs = 0, first_cutoffs = 0, cache_probes = 0, cache_hits = 0, lazy_evals = 0, lazy_exits = 0;
+
+	// same zobrist numbers every run => same node counts
+	init_board_hash(game);
+	srand(2017);
+
+	for (int i = 0; i < BOARD_SIZE; i += 1)
+		for (int j = 0; j <= 16; j += 1)
+			zobristNumbers[i][j] = rand64();
+
+	printf("depth %d\n\n", depth);
+
+	for (int p = 0; p < POSITIONS; p += 1){
+		for (int i = 0; i < BOARD_SIZE; i += 1)
+			game->board[i].value = positions[p][i/4][i%4];
+
+		game->turn = colors[p] == WHITE;
+		init_board_hash(game);
+
+		memset(&_info, 0, sizeof(_info));
+		memset(&live, 0, sizeof(live));
+		tables_alloc(&TTable_deep, &TTable_big, -1);
+
+		timer_start(&timer, NO_TIME_LIMIT, &play);
+		timer.maxdepth = depth;
+
+		getbestmove(game, colors[p], str, TTable_deep, TTable_big, &_info, &timer, &res, &live);
+
+		printf("%d. %10d nodes %8.3fs  [pv %s]\n", p+1, live.info.nodes, live.info.time, live.info.pv);
+
+		nodes += live.info.nodes;
+		time += live.info.time;
+		cutoffs += _info.cutoffs;
+		first_cutoffs += _info.first_cutoffs;
+		cache_probes += _info.cache_probes;
+		cache_hits += _info.cache_hits;
+		lazy_evals += _info.lazy_evals;
+		lazy_exits += _info.lazy_exits;
+
+		tables_free(TTable_deep, TTable_big);
+	}
+
+	printf("\ntotal => %ld nodes, %.3fs, %.0fnps\n", nodes, time, nodes / time);
+	printf("cutoffs => %lu, %.1f%% by the first move\n", cutoffs, cutoffs ? 100.0 * first_cutoffs / cutoffs : 0.0);
+	printf("lazy eval => %.1f%% of evaluations\n", lazy_evals ? 100.0 * lazy_exits / lazy_evals : 0.0);
+	printf("evalcache => %ukb, %.1f%% hits\n", EVALCACHE_SIZE * (unsigned int) sizeof(u64) / 1024,
+		cache_probes ? 100.0 * cache_hits / cache_probes : 0.0
+	);
+}
@@ -0,0 +1,347 @@
+
+/**
+ * Kodra (Russian Draught Engine)
+ *
+ * Evaluation tuner
+ *  fits the weights of the handwritten evaluator to game results (Texel's
+ *  method), the loss is the mean squared error between the results and
+ *  sigmoid(quiescence score) over a dataset, computed on every core and
+ *  minimized by coordinate descent on the (integer) weights
+ *
+ *  usage: tune <dataset> [weights file] [passes]
+ *         tune gen <dataset> [games] [depth]
+ *   (the weights file is read if it exists and rewritten after every pass,
+ *    so a stopped run goes on from it, load it with 'set weights <file>';
+ *    'gen' makes a dataset from games of the engine against itself)
+ *
+ * (C) Sochima Biereagu, 2017
+ */
+
+
+#include <math.h>   // (before game.c's log macro)
+
+#include "../src/ai.c"
+
+#ifdef CONST_WEIGHTS
+	#error "the tuner changes the weights, build it without CONST"
+#endif
+
+#define MAX_PLIES 200       // longer games are draws
+#define OPENING_PLIES 6     // random moves before the recorded ones (+ 0..5)
+
+// dataset file, the header then `struct packed positions[count]` (results set)
+struct dataset {
+	char magic[4];          // "KDDS"
+	unsigned int count;
+	struct packed positions[];
+};
+
+// a share of the positions for one thread
+struct worker {
+	const struct packed* positions;
+	int count;
+	double k;
+
+	struct packed* out;     // (gen) recorded positions
+	int games, first, depth;  // (games first .. first+games-1)
+
+	double loss;            // sum of the squared errors
+};
+
+
+// random numbers for each thread (xorshift)
+unsigned int next_random(unsigned int* s){
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+
+// expected result for black (0..1) from a black score
+double sigmoid(double k, int score){
+	return 1.0 / (1.0 + pow(10.0, -k * score / 400.0));
+}
+
+
+// squared errors of the positions of a worker
+THREAD_FUNC(loss_run, arg){
+	struct worker* w = arg;
+	Gamestate* game = malloc(sizeof(Gamestate));
+	struct info* info = calloc(1, sizeof(struct info));
+	struct timer timer;
+	int play = 0, nodes = 0, c, score;
+
+	timer_start(&timer, NO_TIME_LIMIT, &play);
+	w->loss = 0;
+
+	for (int i = 0; i < w->count; i += 1){
+		unpack_position(&w->positions[i], game);
+
+		c = game->turn ? -1 : 1;
+		score = c * quiescence(game, 0, 0, c, -EVAL_INF, EVAL_INF, info, &timer, &nodes);
+
+		double error = (w->positions[i].result + 1) / 2.0 - sigmoid(w->k, score);
+		w->loss += error * error;
+	}
+
+	free(game), free(info);
+	return 0;
+}
+
+
+// mean loss of the dataset with the current weights, on `threads` threads
+double loss(const struct dataset* data, double k, int threads){
+	struct worker workers[threads];
+	thread_t handles[threads];
+	bool started[threads];
+	double sum = 0;
+
+	weights_changed();
+
+	for (int t = 0; t < threads; t += 1){
+		workers[t] = (struct worker) {
+			.positions = data->positions + (long) data->count * t / threads,
+			.count = (long) data->count * (t+1) / threads - (long) data->count * t / threads,
+			.k = k
+		};
+
+		if (!(started[t] = thread_create(&handles[t], loss_run, &workers[t])))
+			loss_run(&workers[t]);
+	}
+
+	// (summed in thread order, the same loss every run)
+	for (int t = 0; t < threads; t += 1){
+		if (started[t]) thread_join(handles[t]);
+		sum += workers[t].loss;
+	}
+
+	return sum / data->count;
+}
+
+
+// the sigmoid scale that fits the current weights best
+double fit_k(const struct dataset* data, int threads){
+	double k = 1.0, best = loss(data, k, threads), l;
+
+	for (double step = 0.5; step >= 0.001; step /= 2){
+		for (int dir = -1; dir <= 1; dir += 2){
+			while (k + dir*step > 0 && (l = loss(data, k + dir*step, threads)) < best)
+				k += dir*step, best = l;
+		}
+	}
+
+	return k;
+}
+
+
+// games of the engine against itself, positions recorded with the result
+THREAD_FUNC(gen_run, arg){
+	struct worker* w = arg;
+	Gamestate* game = malloc(sizeof(Gamestate));
+	struct info* info = malloc(sizeof(struct info));
+	struct TEntry *TTable_deep, *TTable_big;
+	struct timer timer;
+	Movelist moves;
+	Move best;
+
+	unsigned int seed;
+	int play = 0, nodes = 0, first, ply, c, score, result, index;
+
+	w->count = 0;
+
+	if (!tables_alloc(&TTable_deep, &TTable_big, -1)){
+		free(game), free(info);
+		return 0;
+	}
+
+	for (int g = 0; g < w->games; g += 1){
+		// a game depends only on its index, not on the thread count
+		index = w->first + g;
+		seed = (2017 + index) * 2654435761u;
+
+		memset(TTable_deep, 0, DEEP_HASHTABLE_SIZE * sizeof(struct TEntry));
+		memset(TTable_big, 0, BIG_HASHTABLE_SIZE * sizeof(struct TEntry));
+
+		startBoard(game, INIT_BOARD);
+		game->turn = 1; // white starts
+		init_board_hash(game);
+
+		first = w->count;
+		result = 0;
+
+		for (ply = 0; ply < MAX_PLIES; ply += 1){
+			generate_all_moves(game, game->turn, &moves);
+
+			// no moves, side to move lost
+			if (!moves.length){
+				result = game->turn ? 1 : -1;
+				break;
+			}
+
+			if (ply < OPENING_PLIES + index % 6){
+				domove(game, &moves.moves[next_random(&seed) % moves.length]);
+				continue;
+			}
+
+			pack_position(game, &w->out[w->count++]);
+
+			c = game->turn ? -1 : 1;
+
+			memset(info, 0, sizeof(struct info));
+			timer_start(&timer, NO_TIME_LIMIT, &play);
+
+			score = negamax(game, 0, w->depth, c, -EVAL_INF, EVAL_INF, &best, TTable_deep, TTable_big, info, &timer, &nodes, true);
+
+			// a won game, no need to play it out
+			if (abs(score) >= MATE-MAXDEPTH){
+				result = (score > 0) == (c == 1) ? 1 : -1;
+				break;
+			}
+
+			domove(game, &best);
+		}
+
+		for (int i = first; i < w->count; i += 1)
+			w->out[i].result = result;
+	}
+
+	tables_free(TTable_deep, TTable_big);
+	free(game), free(info);
+	return 0;
+}
+
+
+// write a dataset of `games` games
+int gen(const char* path, int games, int depth, int threads){
+	struct worker workers[threads];
+	thread_t handles[threads];
+	struct dataset header = {"KDDS", 0};
+	FILE* out;
+
+	lmr_init();
+	evalcache_alloc();
+
+	for (int t = 0; t < threads; t += 1){
+		workers[t] = (struct worker) {
+			.games = games * (t+1) / threads - games * t / threads,
+			.first = games * t / threads,
+			.depth = depth
+		};
+
+		workers[t].out = malloc(workers[t].games * MAX_PLIES * sizeof(struct packed));
+		thread_create(&handles[t], gen_run, &workers[t]);
+	}
+
+	if (!(out = fopen(path, "wb"))){
+		fprintf(stderr, "cant write %s\n", path);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, out);
+
+	for (int t = 0; t < threads; t += 1){
+		thread_join(handles[t]);
+
+		fwrite(workers[t].out, sizeof(struct packed), workers[t].count, out);
+		header.count += workers[t].count;
+		free(workers[t].out);
+	}
+
+	// with the count
+	rewind(out);
+	fwrite(&header, sizeof(header), 1, out);
+	fclose(out);
+
+	printf("%s => %d games, %u positions (depth %d)\n", path, games, header.count, depth);
+	return 0;
+}
+
+
+int main(int argc, char** argv){
+	if (argc < 2){
+		fprintf(stderr, "usage: tune <dataset> [weights file] [passes]\n       tune gen <dataset> [games] [depth]\n");
+		return 1;
+	}
+
+	int threads = cpu_count();
+
+	// (one set of zobrist numbers)
+	init_board_hash(&(Gamestate){});
+
+	if (strcmp(argv[1], "gen") == 0 && argc > 2)
+		return gen(argv[2], (argc > 3) ? atoi(argv[3]) : 1000, (argc > 4) ? atoi(argv[4]) : 4, threads);
+
+	char* path = (argc > 2) ? argv[2] : "weights.txt";
+	int passes = (argc > 3) ? atoi(argv[3]) : 100;
+
+	size_t size;
+	struct dataset* data = file_map(argv[1], &size);
+
+	if (!data || size < sizeof(struct dataset) || memcmp(data->magic, "KDDS", 4) != 0
+		|| size != sizeof(struct dataset) + data->count * sizeof(struct packed) || !data->count
+	){
+		fprintf(stderr, "cant read dataset %s\n", argv[1]);
+		return 1;
+	}
+
+	// the tuned weights so far
+	if (weights_load(path))
+		printf("%s => weights loaded\n", path);
+
+	// tuned weights, as int pointers, without the man value (the scale the
+	//  others and k are fitted in) and the back rank multiplier (a scale of
+	//  backrank_values), the loss cant tell those from a change of k
+	int* params[128], n = 0;
+
+	for (int i = 0; i < WEIGHT_FIELDS_N; i += 1){
+		if (strcmp(WEIGHT_FIELDS[i].name, "man") == 0 || strcmp(WEIGHT_FIELDS[i].name, "backrank") == 0)
+			continue;
+
+		for (int j = 0; j < WEIGHT_FIELDS[i].count; j += 1)
+			params[n++] = (int*) ((char*) &WEIGHTS + WEIGHT_FIELDS[i].offset) + j;
+	}
+
+	double start = clock_now(),
+		k = fit_k(data, threads),
+		best = loss(data, k, threads), l;
+
+	printf("%u positions, %d weights, %d threads\n", data->count, n, threads);
+	printf("k = %.3f, loss %.6f (%.1fs)\n\n", k, best, clock_now() - start);
+
+	for (int pass = 1; pass <= passes; pass += 1){
+		int changed = 0;
+
+		for (int i = 0; i < n; i += 1){
+			// one up, else one down
+			*params[i] += 1;
+
+			if ((l = loss(data, k, threads)) < best){
+				best = l, changed += 1;
+				continue;
+			}
+
+			*params[i] -= 2;
+
+			if ((l = loss(data, k, threads)) < best){
+				best = l, changed += 1;
+				continue;
+			}
+
+			*params[i] += 1;
+		}
+
+		// checkpoint
+		if (!weights_save(path)){
+			fprintf(stderr, "cant write %s\n", path);
+			return 1;
+		}
+
+		printf("pass %d => loss %.6f, %d weights changed (%.1fs)\n", pass, best, changed, clock_now() - start);
+
+		if (!changed) break;
+	}
+
+	weights_changed();
+	file_unmap(data, size);
+}
@@ -9,7 +9,7 @@
 
 
 #include "greatest.h"
-#include "../src/game.c"
+#include "../src/ai.c"
 
 #define w (WHITE|MAN)
 #define b (BLACK|MAN)
@@ -108,6 +108,28 @@ void init_board(int board[8][4], Gamestate* game){
 }
 
 
+/**
+ *  Determine if a move is in a move list
+ *   (same squares, from the first to the last)
+ */
+bool _inlist(Move* move, Movelist* moves){
+	for (int i = 0; i < moves->length; i += 1){
+		Move* m = &moves->moves[i];
+
+		if (m->length != move->length || m->is_capture != move->is_capture)
+			continue;
+
+		int k = 0;
+		while (k < m->length && m->list[k].from == move->list[k].from && m->list[k].to == move->list[k].to)
+			k += 1;
+
+		if (k == m->length) return true;
+	}
+
+	return false;
+}
+
+
 /*
 =====================
   Draught notation used:
@@ -398,6 +420,129 @@ TEST zobrist_keys_t(void){
 }
 
 
+// test `movehashkey()`, the key of the position
+// after a move must be the one domove() computes
+TEST movehashkey_t(void){
+	char err_msg[] = "movehashkey() doesnt match the key after domove()";
+
+	int (*positions[])[4] = {game0, game1, game2, game3, game4};
+
+	Gamestate * game = &(Gamestate){};
+	Movelist* moves = &(Movelist){0};
+	u64 key;
+
+	for (int p = 0; p < 5; p += 1){
+		init_board(positions[p], game);
+
+		for (int turn = 0; turn <= 1; turn += 1){
+			game->turn = turn;
+			updatehashkey(game);
+
+			generate_all_moves(game, turn, moves);
+
+			for (int i = 0; i < moves->length; i += 1){
+				key = movehashkey(game, &moves->moves[i]);
+
+				domove(game, &moves->moves[i]);
+					ASSERT_EQm(err_msg, true, game->zobristKey == key);
+				undomove(game, &moves->moves[i]);
+			}
+		}
+	}
+
+	PASS();
+}
+
+
+// test the evaluation terms domove()/undomove()
+// keep, against computing them from the board
+TEST eval_terms_t(void){
+	char err_msg[] = "domove() or undomove() evaluation terms dont match the board";
+
+	int (*positions[])[4] = {game0, game1, game2, game3, game4};
+
+	Gamestate * game = &(Gamestate){};
+	Gamestate full, start;
+	Movelist* moves = &(Movelist){0};
+
+	// a network's first layer, so the accumulators are kept too
+	static short weights[NNUE_INPUTS * NNUE_HIDDEN], biases[NNUE_HIDDEN];
+
+	for (int i = 0; i < NNUE_INPUTS * NNUE_HIDDEN; i += 1)
+		weights[i] = rand() % 64 - 32;
+
+	NNUE_WEIGHTS = weights, NNUE_BIASES = biases;
+
+	// and the pattern windows
+	PATTERN_TERMS = true;
+
+	for (int p = 0; p < 5; p += 1){
+		init_board(positions[p], game);
+		start = *game;
+
+		for (int turn = 0; turn <= 1; turn += 1){
+			generate_all_moves(game, turn, moves);
+
+			for (int i = 0; i < moves->length; i += 1){
+				domove(game, &moves->moves[i]);
+					full = *game;
+					init_eval_terms(&full);
+
+					ASSERT_EQm(err_msg, full.code[0], game->code[0]);
+					ASSERT_EQm(err_msg, full.code[1], game->code[1]);
+					ASSERT_EQm(err_msg, full.psq, game->psq);
+					ASSERT_EQm(err_msg, full.menKey, game->menKey);
+					ASSERT_MEM_EQm(err_msg, full.bitboard, game->bitboard, sizeof(full.bitboard));
+					ASSERT_MEM_EQm(err_msg, full.pattern, game->pattern, sizeof(full.pattern));
+					ASSERT_MEM_EQm(err_msg, full.accumulator, game->accumulator, sizeof(full.accumulator));
+				undomove(game, &moves->moves[i]);
+
+				ASSERT_EQm(err_msg, start.code[0], game->code[0]);
+				ASSERT_EQm(err_msg, start.code[1], game->code[1]);
+				ASSERT_EQm(err_msg, start.psq, game->psq);
+				ASSERT_EQm(err_msg, start.menKey, game->menKey);
+				ASSERT_MEM_EQm(err_msg, start.bitboard, game->bitboard, sizeof(start.bitboard));
+				ASSERT_MEM_EQm(err_msg, start.pattern, game->pattern, sizeof(start.pattern));
+				ASSERT_MEM_EQm(err_msg, start.accumulator, game->accumulator, sizeof(start.accumulator));
+			}
+		}
+	}
+
+	NNUE_WEIGHTS = NNUE_BIASES = NULL;
+	PATTERN_TERMS = false;
+
+	PASS();
+}
+
+
+// test a position comes back the same
+// from pack_position()/unpack_position()
+TEST packed_position_t(void){
+	char err_msg[] = "pack_position() or unpack_position() changes the position";
+
+	int (*positions[])[4] = {game0, game1, game2, game3, game4};
+
+	Gamestate * game = &(Gamestate){};
+	Gamestate * unpacked = &(Gamestate){};
+	struct packed p;
+
+	for (int i = 0; i < 5; i += 1){
+		init_board(positions[i], game);
+		game->turn = i & 1;
+		updatehashkey(game);
+
+		pack_position(game, &p);
+		unpack_position(&p, unpacked);
+
+		ASSERT_MEM_EQm(err_msg, game->board, unpacked->board, sizeof(game->board));
+		ASSERT_EQm(err_msg, game->turn, unpacked->turn);
+		ASSERT_EQm(err_msg, game->zobristKey, unpacked->zobristKey);
+		ASSERT_EQm(err_msg, game->psq, unpacked->psq);
+	}
+
+	PASS();
+}
+
 
 // testing `domove()/undomove()`
 TEST do_undo_move_t(void){
@@ -424,6 +569,57 @@ TEST do_undo_move_t(void){
 
 
 
+// test a search stopped right after it starts (or before
+// its first iteration) still returns a legal move
+TEST search_stop_t(void){
+	char err_msg[] = "search stopped at once, returned move isnt legal";
+
+	int (*positions[])[4] = {game0, game1, game2, game3, game4};
+	int colors[] = {BLACK, WHITE};
+
+	struct search* s = calloc(1, sizeof(struct search));
+	Movelist* moves = &(Movelist){0};
+	Move best;
+
+	ASSERT(tables_alloc(&s->TTable_deep, &s->TTable_big, -1));
+	s->cpu = -1;
+
+	for (int i = 0; i < 5; i += 1){
+		for (int c = 0; c < 2; c += 1){
+			init_board(positions[i], &s->game);
+			generate_all_moves(&s->game, colors[c] == WHITE, moves);
+
+			if (!moves->length) continue;
+
+			// search_start(), then search_stop()
+			s->color = colors[c];
+			memset(&s->info, 0, sizeof(struct info));
+			timer_start(&s->timer, NO_TIME_LIMIT, &s->play);
+
+			ASSERT(search_begin(s));
+			search_abort(s);
+
+			ASSERTm(err_msg, _inlist(&s->best, moves));
+
+			// stopped before the first iteration
+			memset(&s->info, 0, sizeof(struct info));
+			timer_start(&s->timer, NO_TIME_LIMIT, &s->play);
+			s->timer.stop = 1;
+
+			best = getbestmove(&s->game, colors[c], s->str, s->TTable_deep, s->TTable_big, &s->info, &s->timer, &s->res, NULL);
+
+			ASSERTm(err_msg, _inlist(&best, moves));
+		}
+	}
+
+	tables_free(s->TTable_deep, s->TTable_big);
+	free(s);
+
+	PASS();
+}
+
+
+
 /////////////////////////////
 // group tests into suites //
 /////////////////////////////
@@ -441,6 +637,15 @@ SUITE (move_generation_test){
 	RUN_TEST(generate_moves_t);
 	RUN_TEST(generate_captures_t);
 	RUN_TEST(zobrist_keys_t);
+	RUN_TEST(movehashkey_t);
+	RUN_TEST(eval_terms_t);
+	RUN_TEST(packed_position_t);
+}
+
+
+// group search tests
+SUITE (search_test){
+	RUN_TEST(search_stop_t);
 }
 
 
@@ -455,6 +660,7 @@ int main(int argc, char **argv) {
 
     RUN_SUITE(helper_functions_test);
     RUN_SUITE(move_generation_test);
+    RUN_SUITE(search_test);
 
 
     GREATEST_MAIN_END();